@@ -0,0 +1,429 @@
+#include <algorithm>
+
+#include "ambiguity.hpp"
+#include "lexer.hpp"
+
+using fmtcpp::Ambiguity;
+using fmtcpp::AmbiguousSpan;
+using fmtcpp::Reading;
+using lexer::TokenType;
+
+char const *fmtcpp::ambiguity_name(Ambiguity const ambiguity) {
+  switch (ambiguity) {
+    case Ambiguity::MULTIPLY_OR_DECLARE: return "MULTIPLY_OR_DECLARE";
+    case Ambiguity::TEMPLATE_OR_COMPARE: return "TEMPLATE_OR_COMPARE";
+    case Ambiguity::CALL_OR_DECLARE:     return "CALL_OR_DECLARE";
+    case Ambiguity::MACRO_CALL:          return "MACRO_CALL";
+    default:                             return "NONE";
+  }
+}
+
+char const *fmtcpp::reading_name(Reading const reading) {
+  switch (reading) {
+    case Reading::DECLARATION: return "DECLARATION";
+    case Reading::EXPRESSION:  return "EXPRESSION";
+    case Reading::MACRO:       return "MACRO";
+    default:                   return "UNRESOLVED";
+  }
+}
+
+namespace {
+
+  constexpr size_t s_none = SIZE_MAX;
+
+  // offsets of the '{' and '}' of a function body
+  struct BodyRange {
+    size_t open;
+    size_t close;
+  };
+
+  // a '{' which isn't closed yet, along with the state of the statement it interrupts
+  struct Frame {
+    bool isBody;
+    size_t openPos;
+    size_t parenDepth;
+    size_t stmtStart;
+    bool headerHasParen;
+  };
+
+  bool is_star_or_amp(TokenType const type) {
+    return type == TokenType::OPER_STAR || type == TokenType::OPER_AMPERSAND;
+  }
+
+  bool is_keyword(TokenType const type) {
+    return type >= TokenType::KEYWORD_BOOL && type <= TokenType::KEYWORD_WHILE;
+  }
+
+  // what may follow the declarator of a declaration: `a * b;` `a * b = c;` `a * b, c;` `a * b[2];` `a * b(c);`
+  bool ends_declarator(TokenType const type) {
+    return type == TokenType::OPER_ASSIGN
+      || type == TokenType::SPECIAL_COMMA
+      || type == TokenType::SPECIAL_BRACKET_OPEN
+      || type == TokenType::SPECIAL_PAREN_OPEN;
+  }
+
+  // Splits the lexed source into statements, with a stack of braces telling function bodies (where
+  // statements may be ambiguous) from class, namespace and enum bodies. Only looks at code tokens,
+  // comments and directives are set aside.
+  class StatementScanner {
+    public:
+      explicit StatementScanner(std::string_view const source)
+      : m_source{source}
+      {
+        for (auto const &tok : lexer::tokenize_text(source.data(), source.length())) {
+          TokenType const type = tok.type();
+          if (type >= TokenType::PREPRO_DIR_INCLUDE && type <= TokenType::PREPRO_DIR_PRAGMA)
+            m_directives.push_back(tok);
+          else if (type != TokenType::NEWLINE && type != TokenType::COMMENT_SINGLELINE && type != TokenType::COMMENT_MULTILINE)
+            m_code.push_back(tok);
+        }
+      }
+
+      // Appends the ambiguous statements to `spans` and, if not nullptr, the outermost function bodies
+      // to `bodies`, both in source order.
+      void run(std::vector<AmbiguousSpan> &spans, std::vector<BodyRange> *const bodies) {
+        std::vector<Frame> frames{};
+        size_t parenDepth = 0;
+        size_t stmtStart = s_none;
+        bool headerHasParen = false; // a ')' at depth 0 in the statement so far, e.g. `void f() const`
+
+        for (size_t i = 0; i < m_code.size(); ++i) {
+          TokenType const type = m_code[i].type();
+          bool const inBody = !frames.empty() && frames.back().isBody;
+
+          if (inBody && parenDepth == 0 && stmtStart != s_none && starts_line(i) && is_macro_call(stmtStart, i)) {
+            add_span(spans, stmtStart, i, Ambiguity::MACRO_CALL);
+            stmtStart = s_none;
+          }
+          if (stmtStart == s_none)
+            stmtStart = i;
+
+          switch (type) {
+            case TokenType::SPECIAL_PAREN_OPEN:
+            case TokenType::SPECIAL_BRACKET_OPEN:
+              ++parenDepth;
+              break;
+
+            case TokenType::SPECIAL_PAREN_CLOSE:
+            case TokenType::SPECIAL_BRACKET_CLOSE:
+              if (parenDepth > 0)
+                --parenDepth;
+              if (parenDepth == 0 && type == TokenType::SPECIAL_PAREN_CLOSE)
+                headerHasParen = true;
+              break;
+
+            case TokenType::SPECIAL_BRACE_OPEN: {
+              // `) {` `) const {` `) : a(1) {` `[](int x) mutable {`, but not `struct S : B {` or `= {`
+              bool const isBody = inBody
+                || (i > 0 && m_code[i - 1].type() == TokenType::SPECIAL_PAREN_CLOSE)
+                || (parenDepth == 0 && headerHasParen);
+              frames.push_back({ isBody, m_code[i].position(), parenDepth, stmtStart, headerHasParen });
+              parenDepth = 0;
+              stmtStart = s_none;
+              headerHasParen = false;
+              break;
+            }
+
+            case TokenType::SPECIAL_BRACE_CLOSE: {
+              if (frames.empty()) {
+                stmtStart = s_none;
+                headerHasParen = false;
+                break;
+              }
+
+              Frame const frame = frames.back();
+              frames.pop_back();
+              if (bodies != nullptr && frame.isBody && (frames.empty() || !frames.back().isBody))
+                bodies->push_back({ frame.openPos, m_code[i].position() });
+
+              parenDepth = frame.parenDepth;
+              stmtStart = frame.stmtStart;
+              headerHasParen = frame.headerHasParen;
+              // a block ends the statement it belongs to, an initializer list or class body doesn't
+              if (frame.isBody && parenDepth == 0) {
+                stmtStart = s_none;
+                headerHasParen = false;
+              }
+              break;
+            }
+
+            case TokenType::SPECIAL_SEMICOLON:
+              if (parenDepth == 0) {
+                if (inBody && stmtStart < i) {
+                  Ambiguity ambiguity;
+                  if (classify(stmtStart, i, ambiguity))
+                    add_span(spans, stmtStart, i, ambiguity);
+                }
+                stmtStart = s_none;
+                headerHasParen = false;
+              }
+              break;
+
+            case TokenType::SPECIAL_COLON: {
+              // `case 1:` `default:` `label:` `public:` start the next statement
+              if (parenDepth > 0 || is_scope_colon(i))
+                break;
+              TokenType const first = m_code[stmtStart].type();
+              if (first == TokenType::KEYWORD_CASE || first == TokenType::KEYWORD_DEFAULT
+                  || (i == stmtStart + 1 && first == TokenType::IDENTIFIER)) {
+                stmtStart = s_none;
+                headerHasParen = false;
+              }
+              break;
+            }
+
+            default:
+              break;
+          }
+        }
+      }
+
+      std::vector<lexer::Token> const &directives() const noexcept { return m_directives; }
+
+    private:
+      TokenType type_at(size_t const idx) const { return m_code[idx].type(); }
+
+      size_t end_of(size_t const idx) const { return m_code[idx].position() + m_code[idx].length(); }
+
+      // true if the code token at `idx` is the first of its line
+      bool starts_line(size_t const idx) const {
+        if (idx == 0)
+          return false;
+        size_t const prevEnd = end_of(idx - 1);
+        return m_source.substr(prevEnd, m_code[idx].position() - prevEnd).find('\n') != std::string_view::npos;
+      }
+
+      // true for either colon of a `::`
+      bool is_scope_colon(size_t const idx) const {
+        auto const adjacent_colons = [this](size_t const first) {
+          return first + 1 < m_code.size()
+            && type_at(first) == TokenType::SPECIAL_COLON
+            && type_at(first + 1) == TokenType::SPECIAL_COLON
+            && end_of(first) == m_code[first + 1].position();
+        };
+        return adjacent_colons(idx) || (idx > 0 && adjacent_colons(idx - 1));
+      }
+
+      // Returns the index past a (possibly qualified) name starting at `idx`, or s_none.
+      size_t match_name(size_t idx, size_t const end) const {
+        if (idx + 1 < end && is_scope_colon(idx))
+          idx += 2;
+        if (idx >= end || type_at(idx) != TokenType::IDENTIFIER)
+          return s_none;
+        ++idx;
+        while (idx + 2 < end && is_scope_colon(idx) && type_at(idx + 2) == TokenType::IDENTIFIER)
+          idx += 3;
+        return idx;
+      }
+
+      // `idx` is a '(' or '[', returns the index past its closing one, or s_none if not before `end`.
+      size_t skip_group(size_t idx, size_t const end) const {
+        size_t depth = 0;
+        for (; idx < end; ++idx) {
+          TokenType const type = type_at(idx);
+          if (type == TokenType::SPECIAL_PAREN_OPEN || type == TokenType::SPECIAL_BRACKET_OPEN)
+            ++depth;
+          else if ((type == TokenType::SPECIAL_PAREN_CLOSE || type == TokenType::SPECIAL_BRACKET_CLOSE) && --depth == 0)
+            return idx + 1;
+        }
+        return s_none;
+      }
+
+      // Returns the index past `* & name` ending a declarator at `idx` (the stars and ampersands
+      // optional), or s_none.
+      size_t match_declarator(size_t idx, size_t const end) const {
+        while (idx < end && is_star_or_amp(type_at(idx)))
+          ++idx;
+        if (idx >= end || type_at(idx) != TokenType::IDENTIFIER)
+          return s_none;
+        ++idx;
+        return idx == end || ends_declarator(type_at(idx)) ? idx : s_none;
+      }
+
+      // Tells whether the statement [first, end) (without its ';') has an ambiguous shape.
+      bool classify(size_t const first, size_t const end, Ambiguity &out) const {
+        size_t idx = match_name(first, end);
+        if (idx == s_none || idx >= end)
+          return false;
+
+        switch (type_at(idx)) {
+          case TokenType::OPER_STAR:
+          case TokenType::OPER_AMPERSAND:
+            out = Ambiguity::MULTIPLY_OR_DECLARE;
+            return match_declarator(idx, end) != s_none;
+
+          case TokenType::OPER_REL_LESSTHAN:
+            // only names and numbers between the angle brackets, anything else settles it
+            for (++idx; idx < end; ++idx) {
+              TokenType const type = type_at(idx);
+              if (type != TokenType::IDENTIFIER && type != TokenType::LITERAL_NUM
+                  && type != TokenType::SPECIAL_COMMA && type != TokenType::SPECIAL_COLON)
+                break;
+            }
+            if (idx >= end || type_at(idx) != TokenType::OPER_REL_GREATERTHAN)
+              return false;
+            out = Ambiguity::TEMPLATE_OR_COMPARE;
+            return match_declarator(idx + 1, end) != s_none;
+
+          case TokenType::SPECIAL_PAREN_OPEN:
+            // `f(x)(y)`, `f(*x)(y)`: a call of what a call returns, or a function (pointer) declaration
+            ++idx;
+            while (idx < end && is_star_or_amp(type_at(idx)))
+              ++idx;
+            if (idx + 2 >= end || type_at(idx) != TokenType::IDENTIFIER || type_at(idx + 1) != TokenType::SPECIAL_PAREN_CLOSE
+                || type_at(idx + 2) != TokenType::SPECIAL_PAREN_OPEN)
+              return false;
+            out = Ambiguity::CALL_OR_DECLARE;
+            return skip_group(idx + 2, end) == end;
+
+          default:
+            return false;
+        }
+      }
+
+      // true if [first, end) is `name(...)` and the next line starts a new statement
+      bool is_macro_call(size_t const first, size_t const end) const {
+        if (type_at(end - 1) != TokenType::SPECIAL_PAREN_CLOSE)
+          return false;
+        TokenType const next = type_at(end);
+        if (next != TokenType::IDENTIFIER && next != TokenType::SPECIAL_BRACE_CLOSE && !is_keyword(next))
+          return false;
+        size_t const open = match_name(first, end);
+        return open != s_none && open < end && type_at(open) == TokenType::SPECIAL_PAREN_OPEN && skip_group(open, end) == end;
+      }
+
+      void add_span(std::vector<AmbiguousSpan> &spans, size_t const first, size_t const end, Ambiguity const ambiguity) const {
+        spans.push_back({ m_code[first].position(), end_of(end - 1), ambiguity });
+      }
+
+      std::string_view m_source;
+      std::vector<lexer::Token> m_code{};
+      std::vector<lexer::Token> m_directives{};
+  };
+
+  struct SpanResolver {
+    std::vector<AmbiguousSpan> &spans;
+  };
+
+} // namespace
+
+std::vector<AmbiguousSpan> fmtcpp::find_ambiguous_spans(std::string_view const source) {
+  std::vector<AmbiguousSpan> spans{};
+  StatementScanner(source).run(spans, nullptr);
+  return spans;
+}
+
+std::string fmtcpp::detail::blank_unambiguous_bodies(
+  std::string_view const source,
+  std::vector<AmbiguousSpan> const &spans,
+  size_t &numBlanked
+) {
+  StatementScanner scanner(source);
+  std::vector<AmbiguousSpan> unused{};
+  std::vector<BodyRange> bodies{};
+  scanner.run(unused, &bodies);
+
+  std::string skeleton(source);
+  numBlanked = 0;
+
+  auto directive = scanner.directives().begin();
+  auto const directivesEnd = scanner.directives().end();
+
+  for (auto const &body : bodies) {
+    auto const span = std::partition_point(spans.begin(), spans.end(),
+      [&](AmbiguousSpan const &s) { return s.end <= body.open; });
+    if (span != spans.end() && span->begin < body.close)
+      continue;
+
+    // directives may define what code after the body uses, they stay
+    size_t pos = body.open + 1;
+    while (pos < body.close) {
+      while (directive != directivesEnd && directive->position() + directive->length() <= pos)
+        ++directive;
+      size_t const blankEnd = directive == directivesEnd ? body.close : std::min<size_t>(directive->position(), body.close);
+
+      for (; pos < blankEnd; ++pos) {
+        if (skeleton[pos] != '\n' && skeleton[pos] != '\r') {
+          skeleton[pos] = ' ';
+          ++numBlanked;
+        }
+      }
+      if (directive != directivesEnd && pos < body.close)
+        pos = directive->position() + directive->length();
+    }
+  }
+
+  return skeleton;
+}
+
+// Sets the reading of the span a statement-level cursor starts, only descends into cursors
+// overlapping a span.
+static
+CXChildVisitResult resolve_span(
+  CXCursor cursor,
+  [[maybe_unused]] CXCursor parent,
+  CXClientData client_data
+) {
+  auto &spans = static_cast<SpanResolver *>(client_data)->spans;
+
+  CXSourceRange const extent = clang_getCursorExtent(cursor);
+  CXSourceLocation const start = clang_getRangeStart(extent);
+  if (!clang_Location_isFromMainFile(start))
+    return CXChildVisit_Continue;
+
+  // where macro-expanded code was written, the offsets of the skeleton are those of the source
+  unsigned begin_offset, end_offset;
+  clang_getExpansionLocation(start, nullptr, nullptr, nullptr, &begin_offset);
+  clang_getExpansionLocation(clang_getRangeEnd(extent), nullptr, nullptr, nullptr, &end_offset);
+
+  auto const span = std::partition_point(spans.begin(), spans.end(),
+    [&](AmbiguousSpan const &s) { return s.end <= begin_offset; });
+  if (span == spans.end() || span->begin >= end_offset)
+    return CXChildVisit_Continue;
+  if (span->begin != begin_offset)
+    return CXChildVisit_Recurse;
+
+  CXCursorKind const kind = clang_getCursorKind(cursor);
+  // the preprocessor has the final say, whatever the expansion parses as
+  if (kind == CXCursor_MacroExpansion) {
+    span->reading = Reading::MACRO;
+    return CXChildVisit_Continue;
+  }
+  if (span->reading != Reading::UNRESOLVED)
+    return CXChildVisit_Continue;
+
+  if (kind == CXCursor_DeclStmt || clang_isDeclaration(kind)) {
+    span->reading = Reading::DECLARATION;
+    return CXChildVisit_Continue;
+  }
+  if (clang_isExpression(kind)) {
+    span->reading = Reading::EXPRESSION;
+    return CXChildVisit_Continue;
+  }
+  return CXChildVisit_Recurse;
+}
+
+size_t fmtcpp::resolve_ambiguities(
+  Session &session,
+  std::string const &path,
+  std::string_view const source,
+  std::vector<AmbiguousSpan> &spans
+) {
+  if (spans.empty())
+    return 0;
+
+  size_t numBlanked;
+  std::string const skeleton = detail::blank_unambiguous_bodies(source, spans, numBlanked);
+
+  // parsed as the contents of a file next to `path`, so relative #includes resolve the same way
+  std::string const skeletonPath = path + ".ambiguities.cpp";
+
+  CXTranslationUnit transl_unit = nullptr;
+  if (session.parse(skeletonPath, skeleton, session.profile().for_ambiguities(), transl_unit) == CXError_Success) {
+    SpanResolver resolver{ spans };
+    clang_visitChildren(clang_getTranslationUnitCursor(transl_unit), resolve_span, &resolver);
+    session.evict(skeletonPath);
+  }
+
+  return source.length() - numBlanked;
+}
@@ -0,0 +1,81 @@
+// statements the lexer can't classify, resolved by parsing as little as possible
+
+#ifndef FMTCPP_AMBIGUITY_HPP
+#define FMTCPP_AMBIGUITY_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fmtcpp.hpp"
+
+namespace fmtcpp {
+
+// Statements inside function bodies which read as a declaration or an expression depending
+// on what their names are, only a parser knowing the declarations can tell.
+enum class Ambiguity : uint8_t {
+  MULTIPLY_OR_DECLARE, // a * b;   a & b = c;
+  TEMPLATE_OR_COMPARE, // a < b > c;
+  CALL_OR_DECLARE,     // f(x)(y);
+  MACRO_CALL,          // f(x) ending its line without a ';', a macro or a missing ';'
+
+  COUNT
+};
+
+enum class Reading : uint8_t {
+  UNRESOLVED, // not parsed yet, or libclang couldn't tell (e.g. a name it never saw declared)
+  DECLARATION,
+  EXPRESSION,
+  MACRO,      // the statement starts with a macro invocation
+
+  COUNT
+};
+
+// e.g. "MULTIPLY_OR_DECLARE"
+char const *ambiguity_name(Ambiguity);
+char const *reading_name(Reading);
+
+// [begin, end) are byte offsets into the source, the statement without its ';'.
+struct AmbiguousSpan {
+  size_t begin;
+  size_t end;
+  Ambiguity ambiguity;
+  Reading reading = Reading::UNRESOLVED;
+
+  bool operator==(AmbiguousSpan const &) const = default;
+};
+
+// Lexes `source` and returns its ambiguous statements in source order. No parsing is done, a
+// statement only counts when its tokens alone fit one of the shapes above, and function bodies are
+// told apart from class/namespace/enum bodies by a heuristic (the '{' follows a ')' at the same level).
+std::vector<AmbiguousSpan> find_ambiguous_spans(std::string_view source);
+
+// Sets the reading of every span (from `find_ambiguous_spans(source)`) libclang agrees on. Rather than
+// the whole file, libclang parses a copy where every top-level function body without a span is blanked
+// out (offsets, lines and directives are kept), through `session` as a file next to `path` with the
+// session's profile made tolerant (ParseProfile::for_ambiguities). Nothing is parsed when there are no
+// spans. Returns the number of source bytes left to libclang.
+size_t resolve_ambiguities(
+  Session &session,
+  std::string const &path,
+  std::string_view source,
+  std::vector<AmbiguousSpan> &spans
+);
+
+namespace detail {
+
+  // The copy of `source` `resolve_ambiguities` parses: the contents of the outermost function bodies
+  // containing none of `spans` are replaced by spaces, except for newlines and directives.
+  // `numBlanked` is set to the number of bytes blanked out.
+  std::string blank_unambiguous_bodies(
+    std::string_view source,
+    std::vector<AmbiguousSpan> const &spans,
+    size_t &numBlanked
+  );
+
+} // namespace detail
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_AMBIGUITY_HPP
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+#include "arena.hpp"
+
+// blocks are aligned for anything the default operator new would be
+static constexpr std::align_val_t s_blockAlignment{ alignof(std::max_align_t) };
+
+util::Arena::Arena(size_t const initialBlockSize) {
+  add_block(initialBlockSize);
+}
+
+util::Arena::~Arena() {
+  release_blocks();
+}
+
+void util::Arena::reset() {
+  if (m_currBlock > 0) {
+    size_t const totalSize = capacity();
+    release_blocks();
+    add_block(totalSize);
+  }
+
+  m_currBlock = 0;
+  m_currOffset = 0;
+  m_usedInPrevBlocks = 0;
+}
+
+size_t util::Arena::bytes_used() const noexcept {
+  return m_usedInPrevBlocks + m_currOffset;
+}
+
+size_t util::Arena::capacity() const noexcept {
+  size_t total = 0;
+  for (auto const &block : m_blocks)
+    total += block.size;
+  return total;
+}
+
+void *util::Arena::do_allocate(size_t const bytes, size_t const alignment) {
+  while (true) {
+    Block const block = m_blocks[m_currBlock];
+    auto const base = reinterpret_cast<uintptr_t>(block.data);
+    uintptr_t const aligned = (base + m_currOffset + alignment - 1) & ~uintptr_t(alignment - 1);
+    size_t const newOffset = (aligned - base) + bytes;
+
+    if (newOffset <= block.size) {
+      m_currOffset = newOffset;
+      return reinterpret_cast<void *>(aligned);
+    }
+
+    // geometric growth keeps the number of blocks logarithmic in the amount allocated
+    add_block(std::max(block.size * 2, bytes + alignment));
+    m_usedInPrevBlocks += m_currOffset;
+    m_currOffset = 0;
+    m_currBlock = m_blocks.size() - 1;
+  }
+}
+
+void util::Arena::do_deallocate(void *, size_t, size_t) {
+  // everything is released by `reset`
+}
+
+bool util::Arena::do_is_equal(std::pmr::memory_resource const &other) const noexcept {
+  return this == &other;
+}
+
+void util::Arena::add_block(size_t const minSize) {
+  size_t const size = std::max<size_t>(minSize, 256);
+  auto *const data = static_cast<char *>(::operator new(size, s_blockAlignment));
+  m_blocks.push_back({ data, size });
+}
+
+void util::Arena::release_blocks() noexcept {
+  for (auto const &block : m_blocks)
+    ::operator delete(block.data, s_blockAlignment);
+  m_blocks.clear();
+}
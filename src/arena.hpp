@@ -0,0 +1,53 @@
+#ifndef FMTCPP_ARENA_HPP
+#define FMTCPP_ARENA_HPP
+
+#include <memory_resource>
+#include <vector>
+
+namespace util {
+
+// Monotonic allocator for state which lives exactly as long as the processing of one file.
+// Allocation bumps a pointer, deallocation does nothing, `reset` releases everything at once.
+// Memory is kept across resets, so a long-lived arena (e.g. one per worker thread) stops
+// touching the global heap after the first few files, which keeps threads from contending on it.
+// Usable wherever a std::pmr::memory_resource is, not thread-safe.
+class Arena : public std::pmr::memory_resource {
+  public:
+    explicit Arena(size_t initialBlockSize = 64 * 1024);
+    ~Arena() override;
+
+    Arena(Arena const &) = delete;
+    Arena &operator=(Arena const &) = delete;
+
+    // Invalidates everything allocated so far. If the last round needed more than
+    // one block, they're merged into a single one big enough for all of it.
+    void reset();
+
+    // Bytes handed out since the last reset, alignment padding included.
+    size_t bytes_used() const noexcept;
+    // Bytes held from the global heap.
+    size_t capacity() const noexcept;
+
+  protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *ptr, size_t bytes, size_t alignment) override;
+    bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override;
+
+  private:
+    struct Block {
+      char *data;
+      size_t size;
+    };
+
+    void add_block(size_t minSize);
+    void release_blocks() noexcept;
+
+    std::vector<Block> m_blocks{};
+    size_t m_currBlock = 0; // index into m_blocks
+    size_t m_currOffset = 0; // within m_blocks[m_currBlock]
+    size_t m_usedInPrevBlocks = 0;
+};
+
+} // namespace util
+
+#endif // FMTCPP_ARENA_HPP
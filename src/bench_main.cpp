@@ -0,0 +1,531 @@
+// throughput benchmarks over a synthetic, seeded corpus, see print_usage
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "fmtcpp.hpp"
+#include "lexer.hpp"
+#include "scan.hpp"
+#include "util.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define FMTCPP_NOINLINE __attribute__((noinline))
+#else
+  #define FMTCPP_NOINLINE
+#endif
+
+// every allocation made by the benchmarked code is counted, frees aren't interesting
+static std::atomic<uint64_t> s_numAllocs = 0;
+static std::atomic<uint64_t> s_numAllocBytes = 0;
+
+// all forms go through these two, kept out of line: once inlined into a caller g++ sees malloc/free
+// where it expects new/delete and reports them as mismatched (-Wmismatched-new-delete)
+FMTCPP_NOINLINE void *operator new(size_t const size) {
+  s_numAllocs.fetch_add(1, std::memory_order_relaxed);
+  s_numAllocBytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *const ptr = std::malloc(size == 0 ? 1 : size))
+    return ptr;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t const size) { return operator new(size); }
+FMTCPP_NOINLINE void operator delete(void *const ptr) noexcept { std::free(ptr); }
+void operator delete[](void *const ptr) noexcept { operator delete(ptr); }
+void operator delete(void *const ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *const ptr, size_t) noexcept { operator delete(ptr); }
+
+// over-aligned allocations (e.g. util::Arena's blocks) are counted too, freed apart from the others
+FMTCPP_NOINLINE void *operator new(size_t const size, std::align_val_t const alignment) {
+  s_numAllocs.fetch_add(1, std::memory_order_relaxed);
+  s_numAllocBytes.fetch_add(size, std::memory_order_relaxed);
+  size_t const align = static_cast<size_t>(alignment);
+#if defined(_WIN32)
+  void *const ptr = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+  // aligned_alloc wants a multiple of the alignment
+  void *const ptr = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+#endif
+  if (ptr != nullptr)
+    return ptr;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t const size, std::align_val_t const alignment) { return operator new(size, alignment); }
+FMTCPP_NOINLINE void operator delete(void *const ptr, std::align_val_t) noexcept {
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+void operator delete[](void *const ptr, std::align_val_t const alignment) noexcept { operator delete(ptr, alignment); }
+void operator delete(void *const ptr, size_t, std::align_val_t const alignment) noexcept { operator delete(ptr, alignment); }
+void operator delete[](void *const ptr, size_t, std::align_val_t const alignment) noexcept { operator delete(ptr, alignment); }
+
+namespace {
+
+  enum class CorpusKind : uint8_t {
+    MACRO,
+    COMMENT,
+    TEMPLATE,
+    STRING,
+    COUNT,
+  };
+
+  char const *const s_corpusNames[] { "macro", "comment", "template", "string" };
+
+  struct CorpusFile {
+    CorpusKind kind;
+    std::string name;
+    std::string text;
+  };
+
+  // std::mt19937_64's output sequence is fully specified by the standard (unlike
+  // the std:: distributions), so a seed gives the same corpus everywhere
+  struct Rng {
+    std::mt19937_64 engine;
+
+    size_t below(size_t const n) { return static_cast<size_t>(engine() % n); }
+    bool chance(size_t const percent) { return below(100) < percent; }
+
+    std::string identifier() {
+      static char const *const s_parts[] {
+        "buffer", "node", "count", "index", "value", "state", "config", "entry",
+        "token", "result", "handle", "offset", "length", "cache", "queue", "item",
+      };
+      std::string ident = s_parts[below(std::size(s_parts))];
+      if (chance(50)) {
+        ident += '_';
+        ident += s_parts[below(std::size(s_parts))];
+      }
+      if (chance(30))
+        ident += std::to_string(below(100));
+      return ident;
+    }
+
+    std::string macro_name() {
+      std::string name = identifier();
+      std::transform(name.begin(), name.end(), name.begin(),
+        [](char const c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); });
+      return name;
+    }
+
+    std::string type() {
+      static char const *const s_types[] {
+        "int", "unsigned long", "char const *", "double", "size_t", "std::string", "bool", "float",
+      };
+      return s_types[below(std::size(s_types))];
+    }
+
+    std::string words(size_t const count) {
+      static char const *const s_words[] {
+        "the", "returns", "unless", "pointer", "which", "is", "never", "null", "when",
+        "called", "before", "init", "buffer", "owned", "by", "caller", "see", "also",
+      };
+      std::string text{};
+      for (size_t i = 0; i < count; ++i) {
+        if (i > 0)
+          text += ' ';
+        text += s_words[below(std::size(s_words))];
+      }
+      return text;
+    }
+  };
+
+  void append_macro_heavy(Rng &rng, std::string &out) {
+    std::string const name = rng.macro_name();
+
+    switch (rng.below(4)) {
+      case 0:
+        out += "#define " + name + "(x, y) \\\n";
+        out += "  do { \\\n";
+        out += "    if ((x) > (y)) " + rng.identifier() + "(x); \\\n";
+        out += "    else " + rng.identifier() + "(y ## _" + rng.identifier() + "); \\\n";
+        out += "  } while (0)\n";
+        break;
+      case 1:
+        out += "#ifdef " + name + "\n";
+        out += "#  if " + rng.macro_name() + " >= " + std::to_string(rng.below(1000)) + "\n";
+        out += "#    define " + rng.macro_name() + " " + std::to_string(rng.below(1 << 20)) + "u\n";
+        out += "#  elif defined(" + rng.macro_name() + ")\n";
+        out += "#    undef " + rng.macro_name() + "\n";
+        out += "#  else\n";
+        out += "#    error \"" + rng.words(5) + "\"\n";
+        out += "#  endif\n";
+        out += "#endif // " + name + "\n";
+        break;
+      case 2:
+        out += name + "(" + rng.identifier() + ", " + rng.identifier() + ");\n";
+        break;
+      default:
+        out += "#include <" + rng.identifier() + "/" + rng.identifier() + ".h>\n";
+        out += "#pragma " + rng.identifier() + "\n";
+        break;
+    }
+  }
+
+  void append_comment_heavy(Rng &rng, std::string &out) {
+    if (rng.chance(40)) {
+      out += "/**\n";
+      for (size_t i = 0, n = 2 + rng.below(8); i < n; ++i)
+        out += " * " + rng.words(4 + rng.below(10)) + "\n";
+      out += " */\n";
+    } else {
+      for (size_t i = 0, n = 1 + rng.below(4); i < n; ++i)
+        out += "// " + rng.words(3 + rng.below(12)) + "\n";
+    }
+
+    out += rng.type() + " " + rng.identifier() + "(" + rng.type() + " " + rng.identifier() + ") {";
+    out += " /* " + rng.words(3) + " */\n";
+    out += "  return " + rng.identifier() + "; // " + rng.words(4) + "\n";
+    out += "}\n\n";
+  }
+
+  void append_template_heavy(Rng &rng, std::string &out) {
+    std::string const name = rng.identifier();
+
+    out += "template <typename T, typename U = std::vector<std::pair<T, " + rng.type() + ">>, size_t N = "
+      + std::to_string(rng.below(64)) + ">\n";
+    out += "struct " + name + " : " + rng.identifier() + "<T, std::map<U, std::array<T, N>>> {\n";
+    out += "  using " + rng.identifier() + " = typename std::conditional<(N > 1), T, U>::type;\n";
+    out += "  template <typename... Args>\n";
+    out += "  auto " + rng.identifier() + "(Args &&...args) -> decltype(std::declval<T>()(args...)) {\n";
+    out += "    return static_cast<std::tuple<T, U>>(" + rng.identifier() + "<T>::template get<N>(args...));\n";
+    out += "  }\n";
+    out += "};\n";
+    out += name + "<" + rng.type() + "> const " + rng.identifier() + "{};\n\n";
+  }
+
+  void append_string_heavy(Rng &rng, std::string &out) {
+    std::string const name = rng.identifier();
+    size_t const numLines = 16 + rng.below(1024);
+
+    if (rng.chance(50)) {
+      out += "char const *const " + name + " = R\"json(\n";
+      for (size_t i = 0; i < numLines; ++i)
+        out += "  { \"" + rng.identifier() + "\": \"" + rng.words(6) + "\" },\n";
+      out += ")json\";\n\n";
+    } else {
+      out += "char const " + name + "[] = \"";
+      for (size_t i = 0; i < numLines; ++i)
+        out += rng.words(4) + "\\t\\\"" + rng.identifier() + "\\\"\\n";
+      out += "\";\n\n";
+    }
+  }
+
+  std::vector<CorpusFile> generate_corpus(uint64_t const seed, size_t const totalBytes, size_t const fileBytes) {
+    size_t const numKinds = static_cast<size_t>(CorpusKind::COUNT);
+    size_t const filesPerKind = std::max<size_t>(1, totalBytes / (fileBytes * numKinds));
+
+    std::vector<CorpusFile> corpus{};
+    corpus.reserve(filesPerKind * numKinds);
+
+    for (size_t kindIdx = 0; kindIdx < numKinds; ++kindIdx) {
+      auto const kind = static_cast<CorpusKind>(kindIdx);
+
+      for (size_t fileIdx = 0; fileIdx < filesPerKind; ++fileIdx) {
+        // seeded per file, so a file's content doesn't depend on the corpus size
+        Rng rng{ std::mt19937_64(seed * 1'000'003 + kindIdx * 65'537 + fileIdx) };
+
+        CorpusFile file{ kind, util::make_str("%s_%zu.cpp", s_corpusNames[kindIdx], fileIdx), {} };
+        file.text.reserve(fileBytes + fileBytes / 4);
+
+        while (file.text.size() < fileBytes) {
+          switch (kind) {
+            case CorpusKind::MACRO:    append_macro_heavy(rng, file.text); break;
+            case CorpusKind::COMMENT:  append_comment_heavy(rng, file.text); break;
+            case CorpusKind::TEMPLATE: append_template_heavy(rng, file.text); break;
+            default:                   append_string_heavy(rng, file.text); break;
+          }
+        }
+
+        corpus.push_back(std::move(file));
+      }
+    }
+
+    return corpus;
+  }
+
+  // discards everything, so print_nodes is measured without the cost of storing its output
+  class NullBuffer : public std::streambuf {
+    protected:
+      int_type overflow(int_type const ch) override { return ch; }
+      std::streamsize xsputn(char const *, std::streamsize const count) override { return count; }
+  };
+
+  struct StageResult {
+    std::string stage;
+    std::string corpus;
+    size_t numFiles = 0;
+    uint64_t numBytes = 0;
+    uint64_t numTokens = 0;
+    uint64_t numAllocs = 0;
+    uint64_t numAllocBytes = 0;
+    std::vector<double> fileSeconds{}; // one sample per file per repetition
+
+    double total_seconds() const {
+      double total = 0;
+      for (double const secs : fileSeconds)
+        total += secs;
+      return total;
+    }
+
+    double percentile_ms(double const fraction) const {
+      if (fileSeconds.empty())
+        return 0;
+      std::vector<double> sorted = fileSeconds;
+      std::sort(sorted.begin(), sorted.end());
+      // nearest rank
+      auto const rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+      return sorted[rank] * 1000;
+    }
+  };
+
+  struct Options {
+    uint64_t seed = 1;
+    size_t totalMb = 8;
+    size_t fileKb = 256;
+    size_t repeat = 3;
+    bool runLex = true;
+    bool runNodes = true;
+    bool runFormat = true;
+    std::string jsonPath{};
+    std::string corpusDir{};
+  };
+
+  void print_usage() {
+    std::printf(
+      "usage: bench [options]\n"
+      "\n"
+      "runs lexer::tokenize_text (serial and parallel), fmtcpp::print_nodes and\n"
+      "fmtcpp::format_source_code over a generated corpus of macro-, comment-, template-\n"
+      "and string-literal-heavy files\n"
+      "\n"
+      "options:\n"
+      "  --seed <n>           corpus seed (default: 1)\n"
+      "  --size-mb <n>        total corpus size (default: 8)\n"
+      "  --file-kb <n>        size of each file (default: 256)\n"
+      "  --repeat <n>         passes over the corpus per stage (default: 3)\n"
+      "  --stages <list>      comma separated subset of lex,nodes,format (default: all)\n"
+      "  --json <path>        also write results as JSON, '-' for stdout\n"
+      "  --write-corpus <dir> write the generated files to <dir> and exit\n"
+      "  -h, --help           show this message\n"
+    );
+  }
+
+  template <typename Fn>
+  StageResult run_stage(
+    char const *const stage,
+    CorpusKind const kind,
+    std::vector<CorpusFile> const &corpus,
+    std::vector<uint64_t> const &tokenCounts,
+    size_t const repeat,
+    Fn const &fn
+  ) {
+    StageResult result{};
+    result.stage = stage;
+    result.corpus = s_corpusNames[static_cast<size_t>(kind)];
+
+    for (size_t pass = 0; pass < repeat; ++pass) {
+      for (size_t i = 0; i < corpus.size(); ++i) {
+        if (corpus[i].kind != kind)
+          continue;
+
+        uint64_t const allocsBefore = s_numAllocs.load(std::memory_order_relaxed);
+        uint64_t const allocBytesBefore = s_numAllocBytes.load(std::memory_order_relaxed);
+        auto const start = std::chrono::steady_clock::now();
+
+        fn(corpus[i]);
+
+        auto const end = std::chrono::steady_clock::now();
+        result.numAllocs += s_numAllocs.load(std::memory_order_relaxed) - allocsBefore;
+        result.numAllocBytes += s_numAllocBytes.load(std::memory_order_relaxed) - allocBytesBefore;
+
+        result.fileSeconds.push_back(std::chrono::duration<double>(end - start).count());
+        result.numBytes += corpus[i].text.size();
+        result.numTokens += tokenCounts[i];
+        ++result.numFiles;
+      }
+    }
+
+    return result;
+  }
+
+  void write_json(std::FILE *const file, Options const &options, size_t const corpusBytes, std::vector<StageResult> const &results) {
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"version\": \"%s\",\n", fmtcpp::VERSION);
+    std::fprintf(file, "  \"isa\": \"%s\",\n", scan::isa_name(scan::active_isa()));
+    std::fprintf(file, "  \"seed\": %llu,\n", static_cast<unsigned long long>(options.seed));
+    std::fprintf(file, "  \"corpus_bytes\": %zu,\n", corpusBytes);
+    std::fprintf(file, "  \"file_kb\": %zu,\n", options.fileKb);
+    std::fprintf(file, "  \"repeat\": %zu,\n", options.repeat);
+    std::fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); ++i) {
+      StageResult const &res = results[i];
+      double const secs = res.total_seconds();
+      double const files = static_cast<double>(std::max<size_t>(res.numFiles, 1));
+
+      std::fprintf(file,
+        "    { \"stage\": \"%s\", \"corpus\": \"%s\", \"files\": %zu, \"bytes\": %llu, \"tokens\": %llu, "
+        "\"mb_per_s\": %.3f, \"tokens_per_s\": %.0f, \"allocs_per_file\": %.1f, \"alloc_bytes_per_file\": %.0f, "
+        "\"p50_ms\": %.4f, \"p99_ms\": %.4f }%s\n",
+        res.stage.c_str(), res.corpus.c_str(), res.numFiles,
+        static_cast<unsigned long long>(res.numBytes),
+        static_cast<unsigned long long>(res.numTokens),
+        secs > 0 ? static_cast<double>(res.numBytes) / 1e6 / secs : 0,
+        secs > 0 ? static_cast<double>(res.numTokens) / secs : 0,
+        static_cast<double>(res.numAllocs) / files,
+        static_cast<double>(res.numAllocBytes) / files,
+        res.percentile_ms(0.5), res.percentile_ms(0.99),
+        i + 1 < results.size() ? "," : "");
+    }
+
+    std::fprintf(file, "  ]\n}\n");
+  }
+
+} // namespace
+
+int main(int const argc, char const *const *const argv) {
+  namespace fs = std::filesystem;
+
+  Options options{};
+
+  for (int i = 1; i < argc; ++i) {
+    char const *const arg = argv[i];
+    bool const hasValue = i + 1 < argc;
+
+    if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+      print_usage();
+      return 0;
+    } else if (std::strcmp(arg, "--seed") == 0 && hasValue) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--size-mb") == 0 && hasValue) {
+      options.totalMb = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(arg, "--file-kb") == 0 && hasValue) {
+      options.fileKb = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--repeat") == 0 && hasValue) {
+      options.repeat = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--stages") == 0 && hasValue) {
+      std::string const stages = std::string(",") + argv[++i] + ",";
+      options.runLex = stages.find(",lex,") != std::string::npos;
+      options.runNodes = stages.find(",nodes,") != std::string::npos;
+      options.runFormat = stages.find(",format,") != std::string::npos;
+    } else if (std::strcmp(arg, "--json") == 0 && hasValue) {
+      options.jsonPath = argv[++i];
+    } else if (std::strcmp(arg, "--write-corpus") == 0 && hasValue) {
+      options.corpusDir = argv[++i];
+    } else {
+      util::print_err("unknown option or missing value '%s'", arg);
+      print_usage();
+      return 2;
+    }
+  }
+
+  std::vector<CorpusFile> const corpus = generate_corpus(
+    options.seed, options.totalMb * 1024 * 1024, options.fileKb * 1024);
+
+  size_t corpusBytes = 0;
+  for (auto const &file : corpus)
+    corpusBytes += file.text.size();
+
+  if (!options.corpusDir.empty()) {
+    fs::create_directories(options.corpusDir);
+    for (auto const &file : corpus)
+      util::write_file_atomically((fs::path(options.corpusDir) / file.name).string(), file.text);
+    std::printf("wrote %zu files (%zu bytes) to %s\n", corpus.size(), corpusBytes, options.corpusDir.c_str());
+    return 0;
+  }
+
+  // counted once up front, every stage reports tokens/s in terms of these
+  std::vector<uint64_t> tokenCounts{};
+  tokenCounts.reserve(corpus.size());
+  for (auto const &file : corpus)
+    tokenCounts.push_back(lexer::tokenize_text(file.text.c_str(), file.text.size()).size());
+
+  std::vector<StageResult> results{};
+  fmtcpp::Session session{};
+  util::Arena scratch{};
+  NullBuffer nullBuffer{};
+  std::ostream nullStream(&nullBuffer);
+
+  for (size_t kindIdx = 0; kindIdx < static_cast<size_t>(CorpusKind::COUNT); ++kindIdx) {
+    auto const kind = static_cast<CorpusKind>(kindIdx);
+
+    if (options.runLex) {
+      results.push_back(run_stage("tokenize_text", kind, corpus, tokenCounts, options.repeat,
+        [](CorpusFile const &file) {
+          auto const tokens = lexer::tokenize_text(file.text.c_str(), file.text.size());
+          if (tokens.empty() && !file.text.empty())
+            std::abort(); // keeps the call from being optimized away
+        }));
+    }
+    if (options.runLex) {
+      results.push_back(run_stage("tokenize_parallel", kind, corpus, tokenCounts, options.repeat,
+        [](CorpusFile const &file) {
+          auto const tokens = lexer::tokenize_text_parallel(file.text.c_str(), file.text.size());
+          if (tokens.empty() && !file.text.empty())
+            std::abort();
+        }));
+    }
+    if (options.runNodes) {
+      results.push_back(run_stage("print_nodes", kind, corpus, tokenCounts, options.repeat,
+        [&](CorpusFile const &file) {
+          fmtcpp::print_nodes(session, file.name, file.text, nullStream);
+          session.evict(file.name);
+        }));
+    }
+    if (options.runFormat) {
+      results.push_back(run_stage("format_source_code", kind, corpus, tokenCounts, options.repeat,
+        [&](CorpusFile const &file) {
+          // the way the driver calls it, with an arena reused across files
+          scratch.reset();
+          auto const formatted = fmtcpp::format_source_code(file.text, {}, scratch);
+          if (formatted.empty() && !file.text.empty())
+            std::abort();
+        }));
+    }
+  }
+
+  std::printf("corpus: %zu files, %.1f MB, seed %llu, isa %s\n",
+    corpus.size(), static_cast<double>(corpusBytes) / 1e6,
+    static_cast<unsigned long long>(options.seed), scan::isa_name(scan::active_isa()));
+  std::printf("%-20s %-9s %10s %14s %12s %12s %10s %10s\n",
+    "stage", "corpus", "MB/s", "tokens/s", "allocs/file", "KB/file", "p50 ms", "p99 ms");
+
+  for (auto const &res : results) {
+    double const secs = res.total_seconds();
+    double const files = static_cast<double>(std::max<size_t>(res.numFiles, 1));
+    std::printf("%-20s %-9s %10.2f %14.0f %12.1f %12.1f %10.3f %10.3f\n",
+      res.stage.c_str(), res.corpus.c_str(),
+      secs > 0 ? static_cast<double>(res.numBytes) / 1e6 / secs : 0,
+      secs > 0 ? static_cast<double>(res.numTokens) / secs : 0,
+      static_cast<double>(res.numAllocs) / files,
+      static_cast<double>(res.numAllocBytes) / files / 1024,
+      res.percentile_ms(0.5), res.percentile_ms(0.99));
+  }
+
+  if (options.jsonPath == "-") {
+    write_json(stdout, options, corpusBytes, results);
+  } else if (!options.jsonPath.empty()) {
+    std::FILE *const file = std::fopen(options.jsonPath.c_str(), "w");
+    if (file == nullptr) {
+      util::print_err("unable to open '%s' for writing", options.jsonPath.c_str());
+      return 2;
+    }
+    write_json(file, options, corpusBytes, results);
+    std::fclose(file);
+  }
+
+  return 0;
+}
@@ -0,0 +1,221 @@
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "driver.hpp"
+#include "node_dump.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+static
+void print_usage() {
+  std::printf(
+    "usage: fmtcpp [options] <path>...\n"
+    "\n"
+    "paths may be files, directories (searched recursively), globs (*, ?, **)\n"
+    "or compile_commands.json files\n"
+    "\n"
+    "options:\n"
+    "  -j <n>         number of worker threads, up to 1024 (default: one per hardware thread)\n"
+    "  --check        don't write anything, list files which aren't formatted\n"
+    "  --edits        don't write anything, print the edits each file needs as\n"
+    "                 <file>:<offset>:<length>:\"<replacement>\" (C escapes)\n"
+    "  --ambiguities  don't format, print each statement only a parser can classify as\n"
+    "                 <file>:<offset>:<length>:<ambiguity>:<reading>, libclang parsing\n"
+    "                 just the function bodies containing one\n"
+    "  --dump-nodes   write the AST of each file next to it as <file>.nodes\n"
+    "  --binary-nodes with --dump-nodes, write <file>.nodes.bin in a compact binary form\n"
+    "  --nodes-to-text <file>\n"
+    "                 print a <file>.nodes.bin as the text --dump-nodes writes, then exit\n"
+    "  --cache-dir <dir>\n"
+    "                 remember formatting results in <dir>, files seen before\n"
+    "                 (same content, options and fmtcpp version) are skipped\n"
+    "  --std <std>    language standard libclang parses with (default: c++11)\n"
+    "  -I <dir>       add an include path for libclang, also -I<dir>\n"
+    "  -D <def>       define a macro for libclang (NAME or NAME=VALUE), also -D<def>\n"
+    "  --daemon <socket>\n"
+    "                 serve format requests on the Unix domain socket <socket> until\n"
+    "                 a client sends SHUTDOWN (protocol: see src/server.hpp), no paths\n"
+    "  -h, --help     show this message\n"
+  );
+}
+
+// anything larger is a mistake, e.g. a negative number read as unsigned
+static constexpr size_t MAX_THREADS = 1024;
+
+// False unless all of `str` is a number of threads in [1, MAX_THREADS].
+static
+bool parse_num_threads(char const *const str, size_t &out) {
+  char const *const end = str + std::strlen(str);
+  size_t numThreads = 0;
+  auto const [numEnd, err] = std::from_chars(str, end, numThreads);
+  if (err != std::errc{} || numEnd == str || numEnd != end || numThreads == 0 || numThreads > MAX_THREADS)
+    return false;
+  out = numThreads;
+  return true;
+}
+
+static
+int run_daemon(char const *const socketPath, driver::Options const &options) {
+  server::Options serverOptions{};
+  serverOptions.socketPath = socketPath;
+  serverOptions.numThreads = options.numThreads;
+  serverOptions.cacheDir = options.cacheDir;
+  serverOptions.formatOptions = options.formatOptions;
+  serverOptions.parseProfile = options.parseProfile;
+
+  try {
+    server::run(serverOptions);
+  } catch (std::exception const &err) {
+    util::print_err("%s", err.what());
+    return 2;
+  }
+  return 0;
+}
+
+static
+int print_nodes_dump(char const *const path) {
+  try {
+    util::MappedFile const dump(path);
+    if (!fmtcpp::write_dump_as_text(dump.view(), std::cout)) {
+      util::print_err("'%s' is not a valid nodes dump", path);
+      return 2;
+    }
+  } catch (std::exception const &err) {
+    util::print_err("%s", err.what());
+    return 2;
+  }
+  return 0;
+}
+
+int main(int const argc, char const *const *const argv) {
+  driver::Options options{};
+  std::vector<std::string> inputs{};
+  char const *socketPath = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    char const *const arg = argv[i];
+
+    if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+      print_usage();
+      return 0;
+    } else if (std::strcmp(arg, "--check") == 0) {
+      options.check = true;
+    } else if (std::strcmp(arg, "--edits") == 0) {
+      options.listEdits = true;
+    } else if (std::strcmp(arg, "--ambiguities") == 0) {
+      options.listAmbiguities = true;
+    } else if (std::strcmp(arg, "--dump-nodes") == 0) {
+      options.dumpNodes = true;
+    } else if (std::strcmp(arg, "--binary-nodes") == 0) {
+      options.binaryNodes = true;
+    } else if (std::strcmp(arg, "--nodes-to-text") == 0) {
+      if (i + 1 >= argc) {
+        util::print_err("--nodes-to-text expects a file");
+        return 2;
+      }
+      return print_nodes_dump(argv[++i]);
+    } else if (std::strcmp(arg, "--daemon") == 0) {
+      if (i + 1 >= argc) {
+        util::print_err("--daemon expects a socket path");
+        return 2;
+      }
+      socketPath = argv[++i];
+    } else if (std::strcmp(arg, "--cache-dir") == 0) {
+      if (i + 1 >= argc) {
+        util::print_err("--cache-dir expects a directory");
+        return 2;
+      }
+      options.cacheDir = argv[++i];
+    } else if (std::strcmp(arg, "--std") == 0) {
+      if (i + 1 >= argc) {
+        util::print_err("--std expects a language standard");
+        return 2;
+      }
+      options.parseProfile.standard = argv[++i];
+    } else if (std::strncmp(arg, "-I", 2) == 0 || std::strncmp(arg, "-D", 2) == 0) {
+      bool const isInclude = arg[1] == 'I';
+      char const *value = arg + 2;
+      if (*value == '\0') {
+        if (i + 1 >= argc) {
+          util::print_err("%s expects %s", arg, isInclude ? "a directory" : "a definition");
+          return 2;
+        }
+        value = argv[++i];
+      }
+      (isInclude ? options.parseProfile.includePaths : options.parseProfile.defines).emplace_back(value);
+    } else if (std::strcmp(arg, "-j") == 0) {
+      if (i + 1 >= argc) {
+        util::print_err("-j expects a number of threads");
+        return 2;
+      }
+      if (!parse_num_threads(argv[++i], options.numThreads)) {
+        util::print_err("-j expects a number of threads from 1 to %zu, not '%s'", MAX_THREADS, argv[i]);
+        return 2;
+      }
+    } else if (arg[0] == '-' && arg[1] != '\0') {
+      util::print_err("unknown option '%s'", arg);
+      print_usage();
+      return 2;
+    } else {
+      inputs.emplace_back(arg);
+    }
+  }
+
+  if (socketPath != nullptr)
+    return run_daemon(socketPath, options);
+
+  if (inputs.empty()) {
+    print_usage();
+    return 2;
+  }
+
+  std::vector<std::string> files{};
+  try {
+    files = driver::collect_source_files(inputs);
+  } catch (std::exception const &err) {
+    util::print_err("%s", err.what());
+    return 2;
+  }
+
+  driver::Report const report = driver::run(files, options);
+
+  if (options.listAmbiguities) {
+    for (size_t i = 0; i < report.ambiguousFiles.size(); ++i) {
+      for (auto const &span : report.fileAmbiguities[i]) {
+        std::printf("%s:%zu:%zu:%s:%s\n", report.ambiguousFiles[i].c_str(), span.begin, span.end - span.begin,
+          fmtcpp::ambiguity_name(span.ambiguity), fmtcpp::reading_name(span.reading));
+      }
+    }
+    std::fprintf(stderr, "%zu files, %zu with ambiguities, %zu failed\n",
+      report.numFiles, report.ambiguousFiles.size(), report.numFailed);
+    return report.numFailed > 0 ? 2 : 0;
+  }
+
+  if (options.listEdits) {
+    for (size_t i = 0; i < report.changedFiles.size(); ++i) {
+      for (auto const &edit : report.changedFileEdits[i])
+        std::printf("%s:%s\n", report.changedFiles[i].c_str(), fmtcpp::describe_edit(edit).c_str());
+    }
+  } else if (options.check) {
+    for (auto const &file : report.changedFiles)
+      std::printf("%s\n", file.c_str());
+  }
+
+  bool const isDryRun = options.check || options.listEdits;
+
+  std::fprintf(stderr, "%zu files, %zu %s, %zu failed\n",
+    report.numFiles,
+    report.numChanged,
+    isDryRun ? "need formatting" : "reformatted",
+    report.numFailed);
+
+  if (report.numFailed > 0)
+    return 2;
+  if (isDryRun && report.numChanged > 0)
+    return 1;
+  return 0;
+}
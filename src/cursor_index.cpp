@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <utility>
+
+#include "cursor_index.hpp"
+#include "node_walk.hpp"
+
+using fmtcpp::CursorIndex;
+
+fmtcpp::CursorIndex::CursorIndex(std::vector<Node> nodes)
+: m_nodes(std::move(nodes))
+{
+  // a segment made empty by the next one is dropped, neighbours lying in the same node are merged
+  auto const start_segment = [this](uint32_t const begin, uint32_t const nodeIdx) {
+    if (!m_segmentBegins.empty() && m_segmentBegins.back() == begin) {
+      m_segmentBegins.pop_back();
+      m_segmentNodes.pop_back();
+    }
+    if (m_segmentNodes.empty() || m_segmentNodes.back() != nodeIdx) {
+      m_segmentBegins.push_back(begin);
+      m_segmentNodes.push_back(nodeIdx);
+    }
+  };
+
+  // the nodes containing the current position, outermost first
+  std::vector<uint32_t> open{};
+  auto const close_top = [&] {
+    uint32_t const end = m_nodes[open.back()].end;
+    open.pop_back();
+    start_segment(end, open.empty() ? NONE : open.back());
+  };
+
+  start_segment(0, NONE);
+
+  for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+    Node &node = m_nodes[i];
+
+    while (!open.empty() && open.back() != node.parent)
+      close_top();
+    if (open.empty())
+      node.parent = NONE;
+
+    // inside the parent and after whatever came before
+    uint32_t lowest = m_segmentBegins.back();
+    uint32_t highest = UINT32_MAX;
+    if (node.parent != NONE) {
+      lowest = std::max(lowest, m_nodes[node.parent].begin);
+      highest = m_nodes[node.parent].end;
+    }
+    node.begin = std::min(std::max(node.begin, lowest), highest);
+    node.end = std::max(std::min(node.end, highest), node.begin);
+
+    open.push_back(i);
+    start_segment(node.begin, i);
+  }
+
+  while (!open.empty())
+    close_top();
+}
+
+uint32_t fmtcpp::CursorIndex::innermost_at(uint32_t const offset) const {
+  if (m_segmentBegins.empty())
+    return NONE;
+  // the first segment starts at 0
+  auto const segment = std::upper_bound(m_segmentBegins.begin(), m_segmentBegins.end(), offset) - 1;
+  return m_segmentNodes[static_cast<size_t>(segment - m_segmentBegins.begin())];
+}
+
+uint32_t fmtcpp::CursorIndex::enclosing(uint32_t const offset, CXCursorKind const kind) const {
+  uint32_t idx = innermost_at(offset);
+  while (idx != NONE && m_nodes[idx].kind != kind)
+    idx = m_nodes[idx].parent;
+  return idx;
+}
+
+std::vector<uint32_t> fmtcpp::CursorIndex::map_tokens(std::vector<lexer::Token> const &tokens) const {
+  std::vector<uint32_t> nodes{};
+  nodes.reserve(tokens.size());
+
+  size_t segment = 0;
+  for (auto const &tok : tokens) {
+    while (segment + 1 < m_segmentBegins.size() && m_segmentBegins[segment + 1] <= tok.position())
+      ++segment;
+    nodes.push_back(m_segmentBegins.empty() ? NONE : m_segmentNodes[segment]);
+  }
+
+  return nodes;
+}
+
+CursorIndex::Node const &fmtcpp::CursorIndex::node(uint32_t const idx) const {
+  return m_nodes[idx];
+}
+
+std::vector<CursorIndex::Node> const &fmtcpp::CursorIndex::nodes() const noexcept {
+  return m_nodes;
+}
+
+size_t fmtcpp::CursorIndex::num_segments() const noexcept {
+  return m_segmentBegins.size();
+}
+
+CursorIndex fmtcpp::index_cursors(CXTranslationUnit const transl_unit) {
+  std::vector<CursorIndex::Node> nodes{};
+  // node indices of the cursors enclosing the current one, by depth
+  std::vector<uint32_t> ancestors{};
+
+  // preprocessing cursors overlap the declarations around them, those of #included files
+  // are of no use with the tokens of this one
+  auto const skip = [](CXCursor const cursor) {
+    return clang_isPreprocessing(clang_getCursorKind(cursor))
+      || !clang_Location_isFromMainFile(clang_getRangeStart(clang_getCursorExtent(cursor)));
+  };
+
+  detail::walk_nodes(clang_getTranslationUnitCursor(transl_unit), skip, [&](CXCursor const cursor, size_t const depth) {
+    CXSourceRange const extent = clang_getCursorExtent(cursor);
+    unsigned begin_offset, end_offset;
+    clang_getExpansionLocation(clang_getRangeStart(extent), nullptr, nullptr, nullptr, &begin_offset);
+    clang_getExpansionLocation(clang_getRangeEnd(extent), nullptr, nullptr, nullptr, &end_offset);
+
+    ancestors.resize(depth);
+    nodes.push_back({
+      begin_offset,
+      end_offset,
+      clang_getCursorKind(cursor),
+      ancestors.empty() ? CursorIndex::NONE : ancestors.back(),
+    });
+    ancestors.push_back(static_cast<uint32_t>(nodes.size() - 1));
+  });
+
+  return CursorIndex(std::move(nodes));
+}
+
+CursorIndex fmtcpp::index_cursors(Session &session, std::string const &path, std::string_view const source) {
+  CXTranslationUnit transl_unit = nullptr;
+  if (session.parse(path, source, transl_unit) != CXError_Success)
+    return CursorIndex{};
+  return index_cursors(transl_unit);
+}
@@ -0,0 +1,70 @@
+// byte offset -> AST cursor lookups, for combining libclang results with lexer tokens
+
+#ifndef FMTCPP_CURSOR_INDEX_HPP
+#define FMTCPP_CURSOR_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <clang-c/Index.h>
+
+#include "fmtcpp.hpp"
+#include "lexer.hpp"
+
+namespace fmtcpp {
+
+// The cursors of a translation unit's main file as nested intervals of byte offsets, self-contained
+// (the translation unit may be disposed of once it's built). The nested extents are flattened into
+// disjoint segments, each knowing the innermost cursor covering it, so finding the cursor at an
+// offset is one binary search rather than a libclang call.
+class CursorIndex {
+  public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Node {
+      uint32_t begin;
+      uint32_t end;
+      CXCursorKind kind;
+      uint32_t parent; // index of the enclosing node, NONE at the top level
+
+      bool operator==(Node const &) const = default;
+    };
+
+    CursorIndex() = default;
+
+    // `nodes` in pre-order, each after its parent. Extents sticking out of their parent's or
+    // overlapping an earlier sibling's (macro expansions may do that) are clamped.
+    explicit CursorIndex(std::vector<Node> nodes);
+
+    // The innermost node whose extent contains `offset`, or NONE. O(log n).
+    uint32_t innermost_at(uint32_t offset) const;
+
+    // The innermost node of `kind` containing `offset`, or NONE. Walks up from `innermost_at`.
+    uint32_t enclosing(uint32_t offset, CXCursorKind kind) const;
+
+    // `innermost_at` of the start of every token, `tokens` sorted by position. One merge pass,
+    // O(number of tokens + number of segments).
+    std::vector<uint32_t> map_tokens(std::vector<lexer::Token> const &tokens) const;
+
+    Node const &node(uint32_t idx) const;
+    std::vector<Node> const &nodes() const noexcept;
+    size_t num_segments() const noexcept;
+
+  private:
+    std::vector<Node> m_nodes{};
+    // segment i covers [m_segmentBegins[i], m_segmentBegins[i + 1]) and lies in m_segmentNodes[i]
+    std::vector<uint32_t> m_segmentBegins{};
+    std::vector<uint32_t> m_segmentNodes{};
+};
+
+// Builds the index in one traversal of the main file's cursors, preprocessing cursors (macro
+// expansions, inclusion directives) left out. Offsets are those of expansion locations.
+CursorIndex index_cursors(CXTranslationUnit transl_unit);
+
+// Parses `source` as the contents of `path` through `session` and indexes it. Empty if parsing fails.
+CursorIndex index_cursors(Session &session, std::string const &path, std::string_view source);
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_CURSOR_INDEX_HPP
@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include "driver.hpp"
+#include "fmtcpp.hpp"
+#include "format_cache.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+bool driver::detail::matches_glob(std::string_view const pattern, std::string_view const path) {
+  if (pattern.empty())
+    return path.empty();
+
+  if (pattern.starts_with("**")) {
+    std::string_view rest = pattern.substr(2);
+    // "**/" may also match nothing at all, e.g. "src/**/*.cpp" matches "src/a.cpp"
+    if (rest.starts_with('/') && matches_glob(rest.substr(1), path))
+      return true;
+    for (size_t i = 0; i <= path.length(); ++i) {
+      if (matches_glob(rest, path.substr(i)))
+        return true;
+    }
+    return false;
+  }
+
+  switch (pattern.front()) {
+    case '*': {
+      for (size_t i = 0; i <= path.length(); ++i) {
+        if (matches_glob(pattern.substr(1), path.substr(i)))
+          return true;
+        if (i < path.length() && path[i] == '/')
+          break;
+      }
+      return false;
+    }
+    case '?':
+      return !path.empty() && path.front() != '/' && matches_glob(pattern.substr(1), path.substr(1));
+    default:
+      return !path.empty() && path.front() == pattern.front() && matches_glob(pattern.substr(1), path.substr(1));
+  }
+}
+
+bool driver::detail::has_source_extension(std::string_view const path) {
+  static char const *const s_extensions[] {
+    ".c", ".cc", ".cpp", ".cxx", ".c++",
+    ".h", ".hh", ".hpp", ".hxx", ".h++",
+    ".inl", ".ipp", ".tpp",
+  };
+
+  size_t const dotPos = path.find_last_of("./");
+  if (dotPos == std::string_view::npos || path[dotPos] != '.')
+    return false;
+
+  std::string_view const extension = path.substr(dotPos);
+  for (auto const candidate : s_extensions) {
+    if (extension == candidate)
+      return true;
+  }
+  return false;
+}
+
+namespace {
+
+  // just enough JSON to read compile_commands.json
+  struct JsonCursor {
+    std::string_view json;
+    size_t pos = 0;
+
+    [[noreturn]] void fail() const {
+      throw std::runtime_error(util::make_str("malformed JSON at offset %zu", pos));
+    }
+
+    void skip_whitespace() {
+      while (pos < json.length() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\r' || json[pos] == '\n'))
+        ++pos;
+    }
+
+    bool consume(char const c) {
+      skip_whitespace();
+      if (pos < json.length() && json[pos] == c) {
+        ++pos;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char const c) {
+      if (!consume(c))
+        fail();
+    }
+
+    bool next_is(char const c) {
+      skip_whitespace();
+      return pos < json.length() && json[pos] == c;
+    }
+
+    std::string parse_string() {
+      expect('"');
+
+      std::string str{};
+      while (true) {
+        if (pos >= json.length())
+          fail();
+
+        char const c = json[pos++];
+        if (c == '"')
+          return str;
+        if (c != '\\') {
+          str += c;
+          continue;
+        }
+
+        if (pos >= json.length())
+          fail();
+
+        char const escaped = json[pos++];
+        switch (escaped) {
+          case 'b': str += '\b'; break;
+          case 'f': str += '\f'; break;
+          case 'n': str += '\n'; break;
+          case 'r': str += '\r'; break;
+          case 't': str += '\t'; break;
+          case 'u': {
+            if (pos + 4 > json.length())
+              fail();
+            unsigned const codePoint = static_cast<unsigned>(
+              std::stoul(std::string(json.substr(pos, 4)), nullptr, 16));
+            pos += 4;
+            // encode as UTF-8 (surrogate pairs aren't expected in file paths)
+            if (codePoint < 0x80) {
+              str += static_cast<char>(codePoint);
+            } else if (codePoint < 0x800) {
+              str += static_cast<char>(0xC0 | (codePoint >> 6));
+              str += static_cast<char>(0x80 | (codePoint & 0x3F));
+            } else {
+              str += static_cast<char>(0xE0 | (codePoint >> 12));
+              str += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+              str += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+            break;
+          }
+          default: str += escaped; break; // " \ /
+        }
+      }
+    }
+
+    void skip_value() {
+      skip_whitespace();
+      if (pos >= json.length())
+        fail();
+
+      switch (json[pos]) {
+        case '"':
+          parse_string();
+          return;
+        case '{':
+        case '[': {
+          char const close = json[pos] == '{' ? '}' : ']';
+          ++pos;
+          if (consume(close))
+            return;
+          do {
+            if (close == '}') {
+              parse_string();
+              expect(':');
+            }
+            skip_value();
+          } while (consume(','));
+          expect(close);
+          return;
+        }
+        default:
+          // number, true, false, null
+          while (pos < json.length() && !std::strchr(",}] \t\r\n", json[pos]))
+            ++pos;
+          return;
+      }
+    }
+  };
+
+} // namespace
+
+std::vector<std::string> driver::detail::parse_compile_commands(
+  std::string_view const json,
+  std::string_view const jsonDir
+) {
+  JsonCursor cursor{ json };
+  std::vector<std::string> files{};
+
+  cursor.expect('[');
+  if (cursor.consume(']'))
+    return files;
+
+  do {
+    std::string file{};
+    std::string directory{};
+
+    cursor.expect('{');
+    if (!cursor.consume('}')) {
+      do {
+        std::string const key = cursor.parse_string();
+        cursor.expect(':');
+
+        if ((key == "file" || key == "directory") && cursor.next_is('"'))
+          (key == "file" ? file : directory) = cursor.parse_string();
+        else
+          cursor.skip_value();
+      } while (cursor.consume(','));
+      cursor.expect('}');
+    }
+
+    if (file.empty())
+      continue;
+
+    fs::path path(file);
+    if (path.is_relative()) {
+      fs::path dir(directory);
+      if (dir.is_relative())
+        dir = fs::path(jsonDir) / dir;
+      path = dir / path;
+    }
+    files.push_back(path.lexically_normal().generic_string());
+  } while (cursor.consume(','));
+
+  cursor.expect(']');
+  return files;
+}
+
+static
+void expand_glob(std::string const &pattern, std::vector<std::string> &out) {
+  size_t const firstWildcard = pattern.find_first_of("*?");
+  size_t const lastSlash = pattern.rfind('/', firstWildcard);
+
+  fs::path const baseDir = lastSlash == std::string::npos ? "." : pattern.substr(0, lastSlash);
+  std::string const relativePattern = lastSlash == std::string::npos ? pattern : pattern.substr(lastSlash + 1);
+
+  if (!fs::is_directory(baseDir))
+    return;
+
+  auto const consider = [&](fs::directory_entry const &entry) {
+    if (!entry.is_regular_file())
+      return;
+    std::string const relativePath = entry.path().lexically_relative(baseDir).generic_string();
+    if (driver::detail::matches_glob(relativePattern, relativePath))
+      out.push_back(entry.path().lexically_normal().generic_string());
+  };
+
+  bool const crossesDirectories =
+    relativePattern.find('/') != std::string::npos ||
+    relativePattern.find("**") != std::string::npos;
+  auto const options = fs::directory_options::skip_permission_denied;
+
+  if (crossesDirectories) {
+    for (auto const &entry : fs::recursive_directory_iterator(baseDir, options))
+      consider(entry);
+  } else {
+    for (auto const &entry : fs::directory_iterator(baseDir, options))
+      consider(entry);
+  }
+}
+
+std::vector<std::string> driver::collect_source_files(std::vector<std::string> const &inputs) {
+  using util::make_str;
+
+  std::vector<std::string> files{};
+
+  for (auto const &input : inputs) {
+    fs::path const inputPath(input);
+
+    if (input.find_first_of("*?") != std::string::npos) {
+      expand_glob(input, files);
+    } else if (fs::is_directory(inputPath)) {
+      auto const options = fs::directory_options::skip_permission_denied;
+      for (auto const &entry : fs::recursive_directory_iterator(inputPath, options)) {
+        if (entry.is_regular_file() && detail::has_source_extension(entry.path().generic_string()))
+          files.push_back(entry.path().lexically_normal().generic_string());
+      }
+    } else if (inputPath.filename() == "compile_commands.json") {
+      util::MappedFile const json(input.c_str());
+      fs::path const jsonDir = fs::absolute(inputPath).parent_path();
+      auto const entries = detail::parse_compile_commands(json.view(), jsonDir.generic_string());
+      files.insert(files.end(), entries.begin(), entries.end());
+    } else if (fs::is_regular_file(inputPath)) {
+      files.push_back(inputPath.lexically_normal().generic_string());
+    } else {
+      throw std::runtime_error(make_str("'%s' not found", input.c_str()));
+    }
+  }
+
+  // the same file may be spelled differently by different inputs (relative vs absolute...)
+  std::vector<std::pair<std::string, std::string>> canonicalAndSpelling{};
+  canonicalAndSpelling.reserve(files.size());
+  for (auto &file : files)
+    canonicalAndSpelling.emplace_back(fs::weakly_canonical(file).generic_string(), std::move(file));
+
+  std::sort(canonicalAndSpelling.begin(), canonicalAndSpelling.end());
+  canonicalAndSpelling.erase(
+    std::unique(canonicalAndSpelling.begin(), canonicalAndSpelling.end(),
+      [](auto const &lhs, auto const &rhs) { return lhs.first == rhs.first; }),
+    canonicalAndSpelling.end());
+
+  files.clear();
+  for (auto &[canonical, spelling] : canonicalAndSpelling)
+    files.push_back(std::move(spelling));
+
+  return files;
+}
+
+namespace {
+
+  enum class FileStatus : uint8_t {
+    UNCHANGED,
+    CHANGED,
+    FAILED,
+  };
+
+  struct FileResult {
+    FileStatus status = FileStatus::UNCHANGED;
+    std::string error{};
+    std::vector<fmtcpp::Edit> edits{};
+    std::vector<fmtcpp::AmbiguousSpan> ambiguities{};
+  };
+
+  // state owned by one worker thread, reused for every file it formats
+  struct Worker {
+    explicit Worker(fmtcpp::ParseProfile const &profile)
+    : session(profile)
+    {}
+
+    fmtcpp::Session session;
+    util::Arena arena{};
+  };
+
+} // namespace
+
+static
+FileStatus format_file(
+  std::string const &path,
+  driver::Options const &options,
+  Worker &worker,
+  fmtcpp::FormatCache *const cache,
+  std::vector<fmtcpp::Edit> &edits
+) {
+  // whatever the previous file left in there is dead
+  worker.arena.reset();
+
+  std::string formatted{};
+  bool isChanged;
+  {
+    util::MappedFile const source(path.c_str());
+    if (options.listEdits) {
+      edits = fmtcpp::format_edits(source.view(), options.formatOptions, worker.arena);
+      isChanged = !edits.empty();
+    } else if (options.check && cache == nullptr) {
+      // no output needed, stop at the first difference
+      isChanged = !fmtcpp::is_formatted(source.view(), options.formatOptions, worker.arena);
+    } else if (cache != nullptr) {
+      // files the cache knows to be formatted are neither copied nor compared
+      isChanged = fmtcpp::format_source_code(source.view(), options.formatOptions, *cache, worker.arena, formatted);
+    } else {
+      formatted = fmtcpp::format_source_code(source.view(), options.formatOptions, worker.arena);
+      isChanged = formatted != source.view();
+    }
+
+    if (options.dumpNodes) {
+      if (options.binaryNodes) {
+        std::ofstream nodes(path + ".nodes.bin", std::ios::binary);
+        fmtcpp::dump_nodes(worker.session, path, source.view(), nodes);
+      } else {
+        std::ofstream nodes(path + ".nodes");
+        fmtcpp::print_nodes(worker.session, path, source.view(), nodes);
+      }
+      // every file is only visited once, don't hold on to its translation unit
+      worker.session.evict(path);
+    }
+  } // unmapped before being replaced
+
+  if (isChanged && !options.check && !options.listEdits)
+    util::write_file_atomically(path, formatted);
+
+  return isChanged ? FileStatus::CHANGED : FileStatus::UNCHANGED;
+}
+
+static
+std::vector<fmtcpp::AmbiguousSpan> find_ambiguities(std::string const &path, Worker &worker) {
+  util::MappedFile const source(path.c_str());
+  std::vector<fmtcpp::AmbiguousSpan> spans = fmtcpp::find_ambiguous_spans(source.view());
+  fmtcpp::resolve_ambiguities(worker.session, path, source.view(), spans);
+  return spans;
+}
+
+driver::Report driver::run(std::vector<std::string> const &files, Options const &options) {
+  std::vector<FileResult> results(files.size());
+  std::vector<std::unique_ptr<Worker>> workers{};
+
+  // shared by all workers, it holds no state besides its directory
+  std::unique_ptr<fmtcpp::FormatCache> cache{};
+  if (!options.cacheDir.empty())
+    cache = std::make_unique<fmtcpp::FormatCache>(options.cacheDir);
+
+  {
+    util::WorkStealingPool pool(options.numThreads);
+
+    // one libclang session and arena per worker, created on first use by the worker owning it
+    workers.resize(pool.num_threads());
+
+    for (size_t i = 0; i < files.size(); ++i) {
+      pool.submit([&, i](size_t const workerIdx) {
+        try {
+          auto &worker = workers[workerIdx];
+          if (worker == nullptr)
+            worker = std::make_unique<Worker>(options.parseProfile);
+          if (options.listAmbiguities)
+            results[i].ambiguities = find_ambiguities(files[i], *worker);
+          else
+            results[i].status = format_file(files[i], options, *worker, cache.get(), results[i].edits);
+        } catch (std::exception const &err) {
+          results[i].status = FileStatus::FAILED;
+          results[i].error = err.what();
+        }
+      });
+    }
+
+    pool.wait();
+  }
+
+  Report report{};
+  report.numFiles = files.size();
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!results[i].ambiguities.empty()) {
+      report.ambiguousFiles.push_back(files[i]);
+      report.fileAmbiguities.push_back(std::move(results[i].ambiguities));
+    }
+
+    switch (results[i].status) {
+      case FileStatus::CHANGED:
+        ++report.numChanged;
+        report.changedFiles.push_back(files[i]);
+        if (options.listEdits)
+          report.changedFileEdits.push_back(std::move(results[i].edits));
+        break;
+      case FileStatus::FAILED:
+        ++report.numFailed;
+        util::print_err("%s: %s", files[i].c_str(), results[i].error.c_str());
+        break;
+      default:
+        break;
+    }
+  }
+
+  return report;
+}
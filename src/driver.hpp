@@ -0,0 +1,67 @@
+// drives formatting of many files at once, used by the fmtcpp executable
+
+#ifndef FMTCPP_DRIVER_HPP
+#define FMTCPP_DRIVER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ambiguity.hpp"
+#include "fmtcpp.hpp"
+
+namespace driver {
+
+struct Options {
+  size_t numThreads = 0; // 0 means one per hardware thread
+  bool check = false;     // only report files which aren't formatted, don't write anything
+  bool listEdits = false; // don't write anything, report the edits each file needs
+  bool dumpNodes = false; // also write each file's AST next to it as <file>.nodes
+  bool binaryNodes = false; // with dumpNodes, write <file>.nodes.bin in the compact binary form instead
+  bool listAmbiguities = false; // don't format, report each file's ambiguous statements as libclang resolves them
+  std::string cacheDir{};  // directory of the fmtcpp::FormatCache, empty means no caching
+  fmtcpp::FormatOptions formatOptions{};
+  fmtcpp::ParseProfile parseProfile{}; // for every libclang parse (dumpNodes, listAmbiguities)
+};
+
+struct Report {
+  size_t numFiles = 0;
+  size_t numChanged = 0; // reformatted, or in `check` mode, would have been
+  size_t numFailed = 0;
+  std::vector<std::string> changedFiles{};
+  std::vector<std::vector<fmtcpp::Edit>> changedFileEdits{}; // with `listEdits`, parallel to changedFiles
+  // with `listAmbiguities`, the files with ambiguous statements and those statements
+  std::vector<std::string> ambiguousFiles{};
+  std::vector<std::vector<fmtcpp::AmbiguousSpan>> fileAmbiguities{};
+};
+
+// Expands the inputs given on the command line into a sorted, de-duplicated list of files:
+// - directories are searched recursively for C/C++ sources and headers
+// - paths ending in compile_commands.json contribute the "file" of each entry
+// - paths containing wildcards (*, ?, **) are matched against the filesystem
+// - anything else is taken to be a file path
+// Throws std::runtime_error for inputs which don't exist.
+std::vector<std::string> collect_source_files(std::vector<std::string> const &inputs);
+
+// Formats `files` across a work-stealing thread pool. Every worker thread owns
+// its own libclang session and an arena for per-file state. Results are written atomically (to a temporary file
+// which is then renamed over the original), unchanged files aren't touched.
+// With a cache directory, files whose content was seen before are neither lexed
+// nor parsed.
+Report run(std::vector<std::string> const &files, Options const &);
+
+namespace detail {
+
+  // Matches `path` against a glob where `*` and `?` don't cross '/' and `**` does.
+  bool matches_glob(std::string_view pattern, std::string_view path);
+
+  bool has_source_extension(std::string_view path);
+
+  // Returns the absolute "file" paths of the entries of a compile_commands.json.
+  std::vector<std::string> parse_compile_commands(std::string_view json, std::string_view jsonDir);
+
+} // namespace detail
+
+} // namespace driver
+
+#endif // FMTCPP_DRIVER_HPP
@@ -1,16 +1,19 @@
 #include <iostream>
-#include <cassert>
+#include <algorithm>
+#include <utility>
 
 #include "fmtcpp.hpp"
+#include "format_cache.hpp"
+#include "formatter.hpp"
+#include "node_dump.hpp"
+#include "node_walk.hpp"
 #include "util.hpp"
 
-static std::ostream *s_os = nullptr;
-
-CXChildVisitResult print_ast_node(
-  CXCursor cursor,
-  [[maybe_unused]] CXCursor parent,
-  [[maybe_unused]] CXClientData client_data
-) {
+// Calls `use(file_path, line, column, kind, spelling)` with the strings of `cursor`, which are only
+// valid during the call. `file_path` is nullptr for cursors without a location.
+template <typename Use>
+static
+void with_node_strings(CXCursor const cursor, Use const &use) {
   CXSourceLocation location = clang_getCursorLocation(cursor);
   CXFile file;
   unsigned int line, column, offset;
@@ -20,64 +23,460 @@ CXChildVisitResult print_ast_node(
   CXString cursor_spelling = clang_getCursorSpelling(cursor);
   CXString file_name = clang_getFileName(file);
 
-  assert(s_os != nullptr);
-
-  {
-    char const *const file_path = clang_getCString(file_name);
-    if (file_path != nullptr)
-      *s_os << clang_getCString(file_name) << ':' << line << ',' << column << "   ";
-  }
-
-  *s_os << clang_getCString(cursor_kind_spelling) << "   " << clang_getCString(cursor_spelling) << '\n';
+  use(clang_getCString(file_name), line, column, clang_getCString(cursor_kind_spelling), clang_getCString(cursor_spelling));
 
   clang_disposeString(cursor_kind_spelling);
   clang_disposeString(cursor_spelling);
   clang_disposeString(file_name);
+}
+
+static
+void append_node(std::string &out, CXCursor const cursor) {
+  with_node_strings(cursor, [&](
+    char const *const file_path,
+    unsigned const line,
+    unsigned const column,
+    char const *const kind,
+    char const *const spelling
+  ) {
+    if (file_path != nullptr) {
+      out += file_path;
+      out += ':';
+      out += std::to_string(line);
+      out += ',';
+      out += std::to_string(column);
+      out += "   ";
+    }
+
+    out += kind;
+    out += "   ";
+    out += spelling;
+    out += '\n';
+  });
+}
+
+fmtcpp::ParseProfile fmtcpp::ParseProfile::for_symbols() const {
+  ParseProfile profile = *this;
+  profile.parseAllComments = false;
+  profile.precompiledPreamble = false;
+  profile.skipFunctionBodies = true;
+  profile.incomplete = true;
+  profile.keepGoing = true;
+  return profile;
+}
+
+fmtcpp::ParseProfile fmtcpp::ParseProfile::for_ambiguities() const {
+  ParseProfile profile = *this;
+  profile.parseAllComments = false;
+  profile.precompiledPreamble = false;
+  profile.incomplete = true;
+  profile.keepGoing = true;
+  return profile;
+}
+
+std::vector<std::string> fmtcpp::ParseProfile::arguments() const {
+  std::vector<std::string> args{};
+  args.reserve(2 + includePaths.size() + defines.size());
 
-  // Recursively visit the children of the current node
-  clang_visitChildren(cursor, print_ast_node, nullptr);
+  args.push_back("-std=" + standard);
+  if (parseAllComments)
+    args.emplace_back("-fparse-all-comments");
+  for (auto const &includePath : includePaths)
+    args.push_back("-I" + includePath);
+  for (auto const &define : defines)
+    args.push_back("-D" + define);
 
-  return CXChildVisit_Continue;
+  return args;
 }
 
-void fmtcpp::print_nodes(std::string const &cpp_source_code, std::ostream &os) {
+unsigned fmtcpp::ParseProfile::flags() const noexcept {
+  unsigned flags = CXTranslationUnit_None;
+  if (detailedPreprocessing)
+    flags |= CXTranslationUnit_DetailedPreprocessingRecord;
+  if (precompiledPreamble)
+    flags |= CXTranslationUnit_PrecompiledPreamble;
+  if (skipFunctionBodies)
+    flags |= CXTranslationUnit_SkipFunctionBodies;
+  if (incomplete)
+    flags |= CXTranslationUnit_Incomplete;
+  if (keepGoing)
+    flags |= CXTranslationUnit_KeepGoing;
+  return flags;
+}
+
+uint64_t fmtcpp::ParseProfile::fingerprint() const {
+  std::string key{};
+  for (auto const &arg : arguments())
+    key.append(arg).push_back('\0');
+  return util::hash_bytes(key, flags());
+}
+
+fmtcpp::Session::Session(ParseProfile profile)
+: m_profile(std::move(profile)),
+  m_index{clang_createIndex(0, 0)}
+{}
+
+fmtcpp::Session::~Session() {
+  dispose();
+}
+
+fmtcpp::Session::Session(Session &&other) noexcept {
+  *this = std::move(other);
+}
 
-  s_os = &os;
+fmtcpp::Session &fmtcpp::Session::operator=(Session &&other) noexcept {
+  if (this != &other) {
+    dispose();
+    m_profile = std::move(other.m_profile);
+    m_index = std::exchange(other.m_index, nullptr);
+    m_translationUnits = std::move(other.m_translationUnits);
+    other.m_translationUnits.clear();
+  }
+  return *this;
+}
 
-  CXIndex index = clang_createIndex(0, 0);
+void fmtcpp::Session::dispose() noexcept {
+  for (auto const &[path, cached] : m_translationUnits)
+    clang_disposeTranslationUnit(cached.translationUnit);
+  m_translationUnits.clear();
 
+  if (m_index != nullptr)
+    clang_disposeIndex(m_index);
+  m_index = nullptr;
+}
+
+CXErrorCode fmtcpp::Session::parse(
+  std::string const &path,
+  std::string_view const source,
+  CXTranslationUnit &out
+) {
+  return parse(path, source, m_profile, out);
+}
+
+CXErrorCode fmtcpp::Session::parse(
+  std::string const &path,
+  std::string_view const source,
+  ParseProfile const &profile,
+  CXTranslationUnit &out
+) {
+  // libclang takes the length, the contents don't need to be null-terminated
   CXUnsavedFile unsaved_file {
-    "unsaved.cpp",
-    cpp_source_code.c_str(),
-    cpp_source_code.length()
+    path.c_str(),
+    source.data(),
+    static_cast<unsigned long>(source.length())
   };
 
-  char const *arguments[] {
-    "-std=c++11",
-    "-fparse-all-comments",
-  };
+  uint64_t const fingerprint = profile.fingerprint();
+
+  auto const cached = m_translationUnits.find(path);
+  if (cached != m_translationUnits.end()) {
+    CXTranslationUnit const transl_unit = cached->second.translationUnit;
+    int const error = cached->second.profileFingerprint != fingerprint ? 1 : clang_reparseTranslationUnit(
+      transl_unit, 1, &unsaved_file, clang_defaultReparseOptions(transl_unit));
+
+    if (error == 0) {
+      out = transl_unit;
+      return CXError_Success;
+    }
+
+    // the translation unit is unusable after a failed reparse (or was parsed differently), start over
+    clang_disposeTranslationUnit(transl_unit);
+    m_translationUnits.erase(cached);
+  }
 
-  CXTranslationUnit transl_unit;
+  std::vector<std::string> const arguments = profile.arguments();
+  std::vector<char const *> argument_ptrs{};
+  argument_ptrs.reserve(arguments.size());
+  for (auto const &argument : arguments)
+    argument_ptrs.push_back(argument.c_str());
+
+  CXTranslationUnit transl_unit = nullptr;
 
   CXErrorCode const ec = clang_parseTranslationUnit2(
-    index,
-    "unsaved.cpp",
-    arguments,
-    util::lengthof(arguments),
+    m_index,
+    path.c_str(),
+    argument_ptrs.data(),
+    static_cast<int>(argument_ptrs.size()),
     &unsaved_file, 1,
-    CXTranslationUnit_DetailedPreprocessingRecord | CXTranslationUnit_PrecompiledPreamble,
+    profile.flags(),
     &transl_unit
   );
 
-  *s_os << "clang_parseTranslationUnit2 CXErrorCode = " << ec << '\n';
+  if (ec == CXError_Success) {
+    m_translationUnits.emplace(path, Cached{ transl_unit, fingerprint });
+    out = transl_unit;
+  }
+
+  return ec;
+}
+
+void fmtcpp::Session::evict(std::string const &path) {
+  auto const cached = m_translationUnits.find(path);
+  if (cached != m_translationUnits.end()) {
+    clang_disposeTranslationUnit(cached->second.translationUnit);
+    m_translationUnits.erase(cached);
+  }
+}
+
+fmtcpp::ParseProfile const &fmtcpp::Session::profile() const noexcept {
+  return m_profile;
+}
+
+CXIndex fmtcpp::Session::index() const noexcept {
+  return m_index;
+}
+
+size_t fmtcpp::Session::num_cached() const noexcept {
+  return m_translationUnits.size();
+}
+
+void fmtcpp::print_nodes(std::string_view const cpp_source_code, std::ostream &os) {
+  fmtcpp::Session session{};
+  fmtcpp::print_nodes(session, "unsaved.cpp", cpp_source_code, os);
+}
+
+void fmtcpp::print_nodes(
+  fmtcpp::Session &session,
+  std::string const &path,
+  std::string_view const cpp_source_code,
+  std::ostream &os
+) {
+  CXTranslationUnit transl_unit = nullptr;
+  CXErrorCode const ec = session.parse(path, cpp_source_code, transl_unit);
+
+  os << "clang_parseTranslationUnit2 CXErrorCode = " << ec << '\n';
+
+  if (ec != CXError_Success)
+    return;
+
+  // written out in large chunks rather than through the stream node by node
+  size_t constexpr flushThreshold = 64 * 1024;
+  std::string buffer{};
+  buffer.reserve(flushThreshold + 1024);
 
-  CXCursor root_cursor = clang_getTranslationUnitCursor(transl_unit);
-  clang_visitChildren(root_cursor, print_ast_node, nullptr);
+  fmtcpp::detail::walk_nodes(clang_getTranslationUnitCursor(transl_unit), [&](CXCursor const cursor, size_t) {
+    append_node(buffer, cursor);
+    if (buffer.length() >= flushThreshold) {
+      os.write(buffer.data(), static_cast<std::streamsize>(buffer.length()));
+      buffer.clear();
+    }
+  });
 
-  clang_disposeTranslationUnit(transl_unit);
-  clang_disposeIndex(index);
+  os.write(buffer.data(), static_cast<std::streamsize>(buffer.length()));
 }
 
-std::string fmtcpp::format_source_code([[maybe_unused]] std::string const &cpp_source_code) {
-  return "";
+void fmtcpp::dump_nodes(
+  fmtcpp::Session &session,
+  std::string const &path,
+  std::string_view const cpp_source_code,
+  std::ostream &os
+) {
+  CXTranslationUnit transl_unit = nullptr;
+  CXErrorCode const ec = session.parse(path, cpp_source_code, transl_unit);
+
+  fmtcpp::NodeDumpWriter writer(ec);
+
+  if (ec == CXError_Success) {
+    fmtcpp::detail::walk_nodes(clang_getTranslationUnitCursor(transl_unit), [&](CXCursor const cursor, size_t const depth) {
+      with_node_strings(cursor, [&](
+        char const *const file_path,
+        unsigned const line,
+        unsigned const column,
+        char const *const kind,
+        char const *const spelling
+      ) {
+        writer.add(static_cast<uint32_t>(depth), kind, file_path == nullptr ? "" : file_path, line, column, spelling);
+      });
+    });
+  }
+
+  std::string const dump = writer.finish();
+  os.write(dump.data(), static_cast<std::streamsize>(dump.length()));
+}
+
+uint64_t fmtcpp::FormatOptions::fingerprint() const noexcept {
+  uint32_t const fields[] { indentWidth, maxLineLen };
+  return util::hash_bytes(std::string_view(reinterpret_cast<char const *>(fields), sizeof(fields)));
+}
+
+std::string fmtcpp::format_source_code(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options
+) {
+  util::Arena scratch{};
+  return fmtcpp::format_source_code(cpp_source_code, options, scratch);
+}
+
+namespace {
+
+  // stitches the tokens of the source and the formatter's whitespace together
+  class OutputBuilder final : public fmtcpp::GapSink {
+    public:
+      OutputBuilder(std::string_view const source, std::string &out)
+      : m_source{source},
+        m_out{out}
+      {}
+
+      void on_gap(size_t const begin, size_t const end, std::string_view const whitespace) override {
+        m_out.append(m_source.substr(m_prevEnd, begin - m_prevEnd));
+        m_out.append(whitespace);
+        m_prevEnd = end;
+      }
+
+      void finish() {
+        m_out.append(m_source.substr(m_prevEnd));
+      }
+
+    private:
+      std::string_view const m_source;
+      std::string &m_out;
+      size_t m_prevEnd = 0;
+  };
+
+  // collects the gaps which change, optionally only those touching [begin, end]
+  // and only up to `maxEdits` of them
+  class EditCollector final : public fmtcpp::GapSink {
+    public:
+      EditCollector(
+        std::string_view const source,
+        size_t const begin,
+        size_t const end,
+        size_t const maxEdits = SIZE_MAX
+      )
+      : m_source{source},
+        m_begin{begin},
+        m_end{end},
+        m_maxEdits{maxEdits}
+      {}
+
+      void on_gap(size_t const begin, size_t const end, std::string_view const whitespace) override {
+        if (end < m_begin || begin > m_end || is_done())
+          return;
+        if (m_source.substr(begin, end - begin) != whitespace)
+          edits.push_back({ begin, end - begin, std::string(whitespace) });
+      }
+
+      bool is_done() const override {
+        return edits.size() >= m_maxEdits;
+      }
+
+      std::vector<fmtcpp::Edit> edits{};
+
+    private:
+      std::string_view const m_source;
+      size_t const m_begin;
+      size_t const m_end;
+      size_t const m_maxEdits;
+  };
+
+} // namespace
+
+std::vector<fmtcpp::Edit> fmtcpp::format_range(
+  std::string_view const cpp_source_code,
+  size_t const begin,
+  size_t const end,
+  fmtcpp::FormatOptions const &options
+) {
+  return fmtcpp::format_range(cpp_source_code, fmtcpp::BoundaryIndex(cpp_source_code), begin, end, options);
+}
+
+std::vector<fmtcpp::Edit> fmtcpp::format_range(
+  std::string_view const cpp_source_code,
+  fmtcpp::BoundaryIndex const &boundaries,
+  size_t const begin,
+  size_t const end,
+  fmtcpp::FormatOptions const &options
+) {
+  size_t const regionBegin = boundaries.before(begin);
+  size_t const regionEnd = boundaries.after(std::max(begin, end));
+
+  util::Arena scratch{};
+  EditCollector collector(cpp_source_code, begin, end);
+  fmtcpp::format_gaps(cpp_source_code, boundaries, regionBegin, regionEnd, options, scratch, collector);
+
+  return std::move(collector.edits);
+}
+
+std::string fmtcpp::format_source_code(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options,
+  util::Arena &scratch
+) {
+  std::string formatted{};
+  // indentation usually makes up for the whitespace which gets removed
+  formatted.reserve(cpp_source_code.length() + cpp_source_code.length() / 16);
+
+  OutputBuilder builder(cpp_source_code, formatted);
+  fmtcpp::format_gaps(cpp_source_code, options, scratch, builder);
+  builder.finish();
+
+  return formatted;
+}
+
+std::string fmtcpp::describe_edit(Edit const &edit) {
+  std::string desc = std::to_string(edit.offset) + ':' + std::to_string(edit.length) + ":\"";
+  for (char const c : edit.replacement) {
+    switch (c) {
+      case '\n': desc += "\\n"; break;
+      case '\r': desc += "\\r"; break;
+      case '\t': desc += "\\t"; break;
+      default: desc += c; break;
+    }
+  }
+  desc += '"';
+  return desc;
+}
+
+std::vector<fmtcpp::Edit> fmtcpp::format_edits(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options
+) {
+  util::Arena scratch{};
+  return fmtcpp::format_edits(cpp_source_code, options, scratch);
+}
+
+std::vector<fmtcpp::Edit> fmtcpp::format_edits(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options,
+  util::Arena &scratch
+) {
+  EditCollector collector(cpp_source_code, 0, cpp_source_code.length());
+  fmtcpp::format_gaps(cpp_source_code, options, scratch, collector);
+  return std::move(collector.edits);
+}
+
+bool fmtcpp::is_formatted(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options,
+  util::Arena &scratch
+) {
+  EditCollector collector(cpp_source_code, 0, cpp_source_code.length(), 1);
+  fmtcpp::format_gaps(cpp_source_code, options, scratch, collector);
+  return collector.edits.empty();
+}
+
+bool fmtcpp::format_source_code(
+  std::string_view const cpp_source_code,
+  fmtcpp::FormatOptions const &options,
+  fmtcpp::FormatCache &cache,
+  util::Arena &scratch,
+  std::string &formatted
+) {
+  std::string const key = cache.key_of(cpp_source_code, options);
+
+  switch (cache.lookup(key, formatted)) {
+    case fmtcpp::FormatCache::Lookup::ALREADY_FORMATTED:
+      return false;
+    case fmtcpp::FormatCache::Lookup::FORMATTED:
+      return true;
+    default:
+      break;
+  }
+
+  std::string result = fmtcpp::format_source_code(cpp_source_code, options, scratch);
+  cache.store(key, cpp_source_code, result, options);
+  if (result == cpp_source_code)
+    return false;
+  formatted = std::move(result);
+  return true;
 }
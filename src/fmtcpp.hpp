@@ -1,14 +1,181 @@
 #ifndef FMTCPP_PARSER_HPP
 #define FMTCPP_PARSER_HPP
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <clang-c/Index.h>
 
+#include "arena.hpp"
+
 namespace fmtcpp {
 
-void print_nodes(std::string const &cpp_source_code, std::ostream &os);
+// How libclang parses a translation unit.
+struct ParseProfile {
+  std::string standard = "c++11";          // passed as -std=
+  std::vector<std::string> includePaths{}; // passed as -I
+  std::vector<std::string> defines{};      // passed as -D, "NAME" or "NAME=VALUE"
+  bool parseAllComments = true;            // -fparse-all-comments
+  // CXTranslationUnit_ flags:
+  bool detailedPreprocessing = true;       // macro definitions/expansions and #includes become cursors
+  bool precompiledPreamble = true;         // makes reparsing the same path cheap
+  bool skipFunctionBodies = false;         // declarations only
+  bool incomplete = false;                 // the source is a header, don't complete the translation unit
+  bool keepGoing = false;                  // don't stop at fatal errors (e.g. missing #includes)
+
+  // For passes which only need declarations (e.g. SymbolIndex): the same language, paths and
+  // defines, but function bodies and end-of-file template instantiation are skipped, errors
+  // don't stop parsing and nothing is kept for reparsing, several times faster on template-heavy
+  // headers.
+  ParseProfile for_symbols() const;
+
+  // For resolving ambiguous statements (see ambiguity.hpp) in a file parsed once: no comments and
+  // nothing kept for reparsing, errors (e.g. from the function bodies blanked out) don't stop parsing.
+  ParseProfile for_ambiguities() const;
+
+  std::vector<std::string> arguments() const;
+  unsigned flags() const noexcept;
+
+  // Equal profiles have equal fingerprints.
+  uint64_t fingerprint() const;
+};
+
+// Long-lived libclang state: owns an index and every translation unit parsed
+// through it, keyed by path. Parsing a path a second time reparses the cached
+// translation unit, which reuses its precompiled preamble (everything #included
+// before the first declaration), e.g. when the same file is formatted on every save.
+// Not thread-safe, use one session per thread.
+class Session {
+  public:
+    explicit Session(ParseProfile profile = {});
+    ~Session();
+
+    Session(Session const &) = delete;
+    Session &operator=(Session const &) = delete;
+    Session(Session &&) noexcept;
+    Session &operator=(Session &&) noexcept;
+
+    // Parses (or reparses) `source` as the contents of `path`, which needn't exist on disk,
+    // relative #includes are resolved against its directory. On success, `out` stays valid
+    // until the next parse of the same path, `evict` of it, or the session is destroyed.
+    CXErrorCode parse(std::string const &path, std::string_view source, CXTranslationUnit &out);
+
+    // Same as above with another profile than the session's. A cached translation unit
+    // is only reparsed when it was parsed with the same profile.
+    CXErrorCode parse(std::string const &path, std::string_view source, ParseProfile const &, CXTranslationUnit &out);
+
+    // Disposes of the cached translation unit of `path`, if any.
+    void evict(std::string const &path);
+
+    ParseProfile const &profile() const noexcept;
+    CXIndex index() const noexcept;
+    size_t num_cached() const noexcept;
+
+  private:
+    struct Cached {
+      CXTranslationUnit translationUnit;
+      uint64_t profileFingerprint;
+    };
+
+    void dispose() noexcept;
+
+    ParseProfile m_profile;
+    CXIndex m_index = nullptr;
+    std::unordered_map<std::string, Cached> m_translationUnits{};
+};
+
+// Writes every node of the AST of `cpp_source_code` to `os`, one line each, in pre-order.
+// Reentrant: nothing is shared between calls, output is buffered per call.
+void print_nodes(std::string_view cpp_source_code, std::ostream &os);
+
+// Same as above, but parses through `session` as the contents of `path`.
+void print_nodes(Session &session, std::string const &path, std::string_view cpp_source_code, std::ostream &os);
+
+// Same nodes as above in the compact binary form of NodeDumpWriter (node_dump.hpp), with each
+// node's depth, `os` should be opened in binary mode. write_dump_as_text turns it back into text.
+void dump_nodes(Session &session, std::string const &path, std::string_view cpp_source_code, std::ostream &os);
+
+// Bumped whenever formatting output may change, invalidates FormatCache entries.
+inline constexpr char const *VERSION = "0.2.0";
+
+struct FormatOptions {
+  uint32_t indentWidth = 2;
+  uint32_t maxLineLen = 100;
+
+  // Identifies the options for cache keys, equal options have equal fingerprints.
+  uint64_t fingerprint() const noexcept;
+};
+
+class FormatCache;
+class BoundaryIndex;
+
+// A replacement of `length` bytes at `offset`.
+struct Edit {
+  size_t offset;
+  size_t length;
+  std::string replacement;
+
+  bool operator==(Edit const &) const = default;
+};
+
+// "<offset>:<length>:\"<replacement>\"", the (whitespace only) replacement with \n \r \t escaped
+// so the edit fits on one line.
+std::string describe_edit(Edit const &);
+
+// Reformats C/C++ source, only whitespace between tokens changes (see format_gaps in formatter.hpp).
+std::string format_source_code(std::string_view cpp_source_code, FormatOptions const &options = {});
+
+// Same as above, with every intermediate structure allocated from `scratch`, which the
+// caller may reset as soon as this returns (the result doesn't live in it).
+std::string format_source_code(std::string_view cpp_source_code, FormatOptions const &options, util::Arena &scratch);
+
+// Returns the edits turning `cpp_source_code` into what `format_source_code` returns, sorted by
+// offset and non-overlapping. They are taken straight from the formatter's decisions, no output is
+// built and diffed, so an already formatted file costs nothing but the formatting pass.
+std::vector<Edit> format_edits(std::string_view cpp_source_code, FormatOptions const &options = {});
+
+// Same as above, with every intermediate structure allocated from `scratch`.
+std::vector<Edit> format_edits(std::string_view cpp_source_code, FormatOptions const &options, util::Arena &scratch);
+
+// True if formatting wouldn't change `cpp_source_code`, stops at the first edit.
+bool is_formatted(std::string_view cpp_source_code, FormatOptions const &options, util::Arena &scratch);
+
+// Formats only the lines of `source` which overlap [begin, end) (byte offsets), e.g. for an editor
+// formatting a selection. Only the enclosing declarations (top-level or directly inside a namespace)
+// are formatted, but finding where they start lexes the whole source (see BoundaryIndex in
+// formatter.hpp). Returns the edits to apply, sorted by offset and non-overlapping, none if that part
+// is already formatted.
+std::vector<Edit> format_range(
+  std::string_view cpp_source_code,
+  size_t begin,
+  size_t end,
+  FormatOptions const &options = {}
+);
+
+// Same as above with the boundaries of `cpp_source_code` kept up to date by the caller, e.g. an
+// editor updating them on every edit, so only the enclosing declarations are lexed and the cost
+// doesn't depend on the size of the source.
+std::vector<Edit> format_range(
+  std::string_view cpp_source_code,
+  BoundaryIndex const &boundaries,
+  size_t begin,
+  size_t end,
+  FormatOptions const &options = {}
+);
 
-std::string format_source_code(std::string const &cpp_source_code);
+// Same as above, but answers straight from `cache` when `cpp_source_code` was seen before with
+// the same options, and stores the result there otherwise. True if formatting changes the source,
+// `formatted` is set to the result then. False if it's already formatted, `formatted` is left as is
+// and, on a cache hit, the source isn't even copied or compared.
+bool format_source_code(
+  std::string_view cpp_source_code,
+  FormatOptions const &options,
+  FormatCache &cache,
+  util::Arena &scratch,
+  std::string &formatted
+);
 
 } // namespace fmtcpp
 
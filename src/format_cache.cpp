@@ -0,0 +1,48 @@
+#include <filesystem>
+#include <system_error>
+
+#include "format_cache.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+fmtcpp::FormatCache::FormatCache(std::string directory)
+: m_directory(std::move(directory))
+{}
+
+std::string fmtcpp::FormatCache::key_of(std::string_view const source, FormatOptions const &options) {
+  // seeded by everything besides the source which affects the output
+  return util::content_key(source, util::hash_bytes(VERSION, options.fingerprint()));
+}
+
+fmtcpp::FormatCache::Lookup fmtcpp::FormatCache::lookup(std::string const &key, std::string &formatted) const {
+  std::error_code err{};
+  if (fs::exists(util::sharded_entry_path(m_directory, key, ".ok"), err))
+    return Lookup::ALREADY_FORMATTED;
+
+  auto const entry = util::read_entry(util::sharded_entry_path(m_directory, key, ".out"));
+  if (!entry)
+    return Lookup::MISS;
+
+  formatted = std::string(entry->view());
+  return Lookup::FORMATTED;
+}
+
+void fmtcpp::FormatCache::store(
+  std::string const &key,
+  std::string_view const source,
+  std::string_view const formatted,
+  FormatOptions const &options
+) {
+  if (formatted == source) {
+    util::write_entry(util::sharded_entry_path(m_directory, key, ".ok"), "");
+    return;
+  }
+
+  util::write_entry(util::sharded_entry_path(m_directory, key, ".out"), formatted);
+  util::write_entry(util::sharded_entry_path(m_directory, key_of(formatted, options), ".ok"), "");
+}
+
+std::string const &fmtcpp::FormatCache::directory() const noexcept {
+  return m_directory;
+}
@@ -0,0 +1,48 @@
+#ifndef FMTCPP_FORMAT_CACHE_HPP
+#define FMTCPP_FORMAT_CACHE_HPP
+
+#include <string>
+#include <string_view>
+
+#include "fmtcpp.hpp"
+
+namespace fmtcpp {
+
+// Content-addressed cache of formatting results, kept in a local directory so
+// it survives between runs (and can be shared between CI jobs).
+// Entries are keyed by a hash of the source bytes, the formatter options and
+// fmtcpp::VERSION, so changing either of the latter two invalidates everything.
+// Layout: <directory>/<first 2 chars of key>/<key>.ok   - source was already formatted
+//         <directory>/<first 2 chars of key>/<key>.out  - formatted source
+// Entries are written atomically, so one directory may be used by many threads
+// and processes at once. A corrupt or unreadable entry is treated as a miss.
+class FormatCache {
+  public:
+    enum class Lookup : uint8_t {
+      MISS,
+      ALREADY_FORMATTED,
+      FORMATTED, // formatted source was written to the output argument
+    };
+
+    // The directory is created on the first store.
+    explicit FormatCache(std::string directory);
+
+    // 32 hex characters.
+    static std::string key_of(std::string_view source, FormatOptions const &options);
+
+    Lookup lookup(std::string const &key, std::string &formatted) const;
+
+    // Records the result of formatting the source `key` was computed from. If the
+    // source changed, the formatted output is also recorded as already formatted,
+    // so the next run over the rewritten file is a hit as well.
+    void store(std::string const &key, std::string_view source, std::string_view formatted, FormatOptions const &options);
+
+    std::string const &directory() const noexcept;
+
+  private:
+    std::string m_directory;
+};
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_FORMAT_CACHE_HPP
@@ -0,0 +1,881 @@
+#include <algorithm>
+#include <cstring>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "formatter.hpp"
+#include "lexer.hpp"
+
+using lexer::TokenType;
+
+namespace {
+
+  enum class GapKind : uint8_t {
+    FLAT,        // `numSpaces` spaces
+    BREAK,       // FLAT, or a line break if what follows doesn't fit on the line
+    NEWLINES,    // `numNewlines` line breaks followed by the indentation of the next line
+    KEEP_INDENT, // `numNewlines` line breaks followed by the original indentation
+    VERBATIM,    // left as is
+  };
+
+  // a token along with the gap in front of it
+  struct Item {
+    uint32_t gapBegin;
+    uint32_t tokBegin;
+    uint32_t tokEnd;
+    TokenType type;
+    GapKind gapKind;
+    uint8_t numSpaces;
+    uint8_t numNewlines;
+    uint32_t width;      // of the token as far as fitting is concerned
+    uint64_t startWidth; // running width in front of the gap
+    uint64_t breakSize;  // BREAK only, width from the gap up to the next break at the same level
+  };
+
+  constexpr uint64_t s_unknownSize = UINT64_MAX;
+
+  // an unbalanced opening paren/bracket/brace, as seen when printing
+  struct Open {
+    TokenType type;
+    uint32_t lineIndent;  // of the line the closing one goes on when it starts a line
+    uint32_t innerIndent; // of lines inside
+    bool isControl;       // parens of if/for/while/switch
+    bool hasCaseLabel;    // braces of a switch, once a case label was seen
+  };
+
+  // a BREAK item which doesn't know its size yet
+  struct PendingBreak {
+    uint64_t seq;
+    size_t depth;
+  };
+
+  // line breaks as the lexer sees them, "\r\n" counting once and a lone '\r' as one of its own
+  size_t count_line_breaks(std::string_view const str) {
+    size_t count = 0;
+    for (size_t i = 0; i < str.length(); ++i) {
+      if (str[i] == '\n' || (str[i] == '\r' && (i + 1 == str.length() || str[i + 1] != '\n')))
+        ++count;
+    }
+    return count;
+  }
+
+  bool is_directive(TokenType const type) {
+    return type >= TokenType::PREPRO_DIR_INCLUDE && type <= TokenType::PREPRO_DIR_PRAGMA;
+  }
+
+  bool is_comment(TokenType const type) {
+    return type == TokenType::COMMENT_SINGLELINE || type == TokenType::COMMENT_MULTILINE;
+  }
+
+  bool is_opener(TokenType const type) {
+    return type == TokenType::SPECIAL_PAREN_OPEN
+      || type == TokenType::SPECIAL_BRACKET_OPEN
+      || type == TokenType::SPECIAL_BRACE_OPEN;
+  }
+
+  bool closes(TokenType const closer, TokenType const opener) {
+    switch (closer) {
+      case TokenType::SPECIAL_PAREN_CLOSE:   return opener == TokenType::SPECIAL_PAREN_OPEN;
+      case TokenType::SPECIAL_BRACKET_CLOSE: return opener == TokenType::SPECIAL_BRACKET_OPEN;
+      case TokenType::SPECIAL_BRACE_CLOSE:   return opener == TokenType::SPECIAL_BRACE_OPEN;
+      default:                               return false;
+    }
+  }
+
+  bool is_closer(TokenType const type) {
+    return type == TokenType::SPECIAL_PAREN_CLOSE
+      || type == TokenType::SPECIAL_BRACKET_CLOSE
+      || type == TokenType::SPECIAL_BRACE_CLOSE;
+  }
+
+  bool is_case_label(TokenType const type) {
+    return type == TokenType::KEYWORD_CASE || type == TokenType::KEYWORD_DEFAULT;
+  }
+
+  bool is_control_keyword(TokenType const type) {
+    return type == TokenType::KEYWORD_IF
+      || type == TokenType::KEYWORD_FOR
+      || type == TokenType::KEYWORD_WHILE
+      || type == TokenType::KEYWORD_SWITCH;
+  }
+
+  // a line ending in one of these is continued on the next.
+  // not * & < > since they end lines of declarations (`int *\nfoo()`, `template <...>\n`)
+  bool leaves_expression_open(TokenType const type) {
+    switch (type) {
+      case TokenType::OPER_PLUS:
+      case TokenType::OPER_MINUS:
+      case TokenType::OPER_DIV:
+      case TokenType::OPER_MOD:
+      case TokenType::OPER_ASSIGN:
+      case TokenType::OPER_ASSIGN_ADD:
+      case TokenType::OPER_ASSIGN_SUB:
+      case TokenType::OPER_ASSIGN_MULT:
+      case TokenType::OPER_ASSIGN_DIV:
+      case TokenType::OPER_ASSIGN_MOD:
+      case TokenType::OPER_ASSIGN_BITSHIFTLEFT:
+      case TokenType::OPER_ASSIGN_BITSHIFTRIGHT:
+      case TokenType::OPER_ASSIGN_BITAND:
+      case TokenType::OPER_ASSIGN_BITOR:
+      case TokenType::OPER_ASSIGN_BITXOR:
+      case TokenType::OPER_REL_EQ:
+      case TokenType::OPER_REL_NOTEQ:
+      case TokenType::OPER_REL_LESSTHANEQ:
+      case TokenType::OPER_REL_GREATERTHANEQ:
+      case TokenType::OPER_LOGIC_AND:
+      case TokenType::OPER_LOGIC_OR:
+      case TokenType::OPER_BITWISE_OR:
+      case TokenType::OPER_BITWISE_XOR:
+      case TokenType::OPER_BITWISE_SHIFTLEFT:
+      case TokenType::OPER_DOT:
+      case TokenType::OPER_ARROW:
+      case TokenType::SPECIAL_QUESTION:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // a line starting with one of these continues the previous one.
+  // not * & ++ -- ! ~ since statements may start with them
+  bool continues_expression(TokenType const type) {
+    switch (type) {
+      case TokenType::OPER_PLUS:
+      case TokenType::OPER_MINUS:
+      case TokenType::OPER_DIV:
+      case TokenType::OPER_MOD:
+      case TokenType::OPER_ASSIGN:
+      case TokenType::OPER_REL_EQ:
+      case TokenType::OPER_REL_NOTEQ:
+      case TokenType::OPER_REL_LESSTHANEQ:
+      case TokenType::OPER_REL_GREATERTHANEQ:
+      case TokenType::OPER_LOGIC_AND:
+      case TokenType::OPER_LOGIC_OR:
+      case TokenType::OPER_BITWISE_OR:
+      case TokenType::OPER_BITWISE_XOR:
+      case TokenType::OPER_BITWISE_SHIFTLEFT:
+      case TokenType::OPER_BITWISE_SHIFTRIGHT:
+      case TokenType::OPER_DOT:
+      case TokenType::OPER_ARROW:
+      case TokenType::SPECIAL_QUESTION:
+      case TokenType::SPECIAL_COLON:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  uint8_t spaces_between(TokenType const prev, TokenType const next, bool const hadSpace) {
+    switch (next) {
+      case TokenType::SPECIAL_COMMA:
+      case TokenType::SPECIAL_SEMICOLON:
+      case TokenType::SPECIAL_PAREN_CLOSE:
+      case TokenType::SPECIAL_BRACKET_CLOSE:
+        return 0;
+      default:
+        break;
+    }
+
+    switch (prev) {
+      case TokenType::SPECIAL_PAREN_OPEN:
+        return 0;
+      case TokenType::SPECIAL_BRACKET_OPEN:
+        // `a[ [x] { ... }() ]` mustn't turn into an attribute
+        return (hadSpace && next == TokenType::SPECIAL_BRACKET_OPEN) ? 1 : 0;
+      case TokenType::SPECIAL_COMMA:
+      case TokenType::SPECIAL_SEMICOLON:
+        return 1;
+      default:
+        return hadSpace ? 1 : 0;
+    }
+  }
+
+  class Formatter {
+    public:
+      Formatter(
+        std::string_view const source,
+        size_t const begin,
+        size_t const end,
+        fmtcpp::FormatOptions const &options,
+        util::Arena &scratch,
+        fmtcpp::GapSink &sink
+      )
+      : m_source{source},
+        m_end{end},
+        m_options{options},
+        m_sink{sink},
+        m_queue(&scratch),
+        m_scanStack(&scratch),
+        m_openTypes(&scratch),
+        m_prevEnd{static_cast<uint32_t>(begin)},
+        m_opens(&scratch),
+        m_whitespace(&scratch)
+      {
+        // the first line break of the file says which kind to write
+        size_t const firstBreak = source.find_first_of("\r\n");
+        if (firstBreak != std::string_view::npos && source[firstBreak] == '\r')
+          m_newline = source.substr(firstBreak, 2) == "\r\n" ? "\r\n" : "\r";
+      }
+
+      // Formats [begin, end), the first lines of a block around the region, without reporting any
+      // of it, so that the region is indented as it is inside of the block.
+      void replay(size_t const begin, size_t const end) {
+        uint32_t const regionBegin = m_prevEnd;
+        m_prevEnd = static_cast<uint32_t>(begin);
+        m_isReplaying = true;
+        push_tokens(begin, end);
+        terminate_breaks(0, m_runWidth);
+        flush();
+        m_isReplaying = false;
+
+        // the region starts on a line of its own
+        m_prevEnd = regionBegin;
+        m_isFirst = true;
+        m_column = 0;
+      }
+
+      void run() {
+        size_t const textLen = m_end;
+        size_t const pos = push_tokens(m_prevEnd, textLen);
+        if (m_sink.is_done())
+          return;
+
+        terminate_breaks(0, m_runWidth);
+        flush();
+
+        // the lexer stops at the first character it doesn't know, from there on everything stays as is
+        bool const stoppedEarly = pos < textLen;
+        std::string_view const lastGap = m_source.substr(m_prevEnd, (stoppedEarly ? pos : textLen) - m_prevEnd);
+
+        if (stoppedEarly) {
+          m_sink.on_gap(m_prevEnd, pos, lastGap);
+        } else if (textLen == m_source.length()) {
+          m_sink.on_gap(m_prevEnd, textLen, m_isFirst ? "" : m_newline);
+        } else if (m_isFirst) {
+          m_sink.on_gap(m_prevEnd, textLen, lastGap);
+        } else {
+          // a region ends at the start of a boundary line, its indentation belongs to the next region
+          size_t const numNewlines = count_line_breaks(lastGap);
+          m_whitespace.clear();
+          for (size_t i = 0; i < std::min<size_t>(numNewlines, 2); ++i)
+            m_whitespace += m_newline;
+          m_sink.on_gap(m_prevEnd, textLen, m_whitespace);
+        }
+      }
+
+    private:
+      // Pushes the tokens of [pos, end), returns where the lexer stopped.
+      size_t push_tokens(size_t pos, size_t const end) {
+        char const *const text = m_source.data();
+        while (pos < end) {
+          lexer::Token const tok = lexer::detail::extract_token(text, end, pos);
+          if (tok.type() == TokenType::NIL)
+            break;
+          pos += tok.length();
+          if (tok.type() != TokenType::NEWLINE)
+            push(tok);
+          if (m_sink.is_done())
+            break;
+        }
+        return pos;
+      }
+
+      // input side, classifies gaps and works out the sizes of breaks
+
+      void push(lexer::Token const &tok) {
+        TokenType const type = tok.type();
+        uint32_t const begin = tok.position();
+        uint32_t const end = begin + tok.length();
+
+        std::string_view const gap = m_source.substr(m_prevEnd, begin - m_prevEnd);
+        std::string_view const text = m_source.substr(begin, end - begin);
+        size_t const numNewlines = count_line_breaks(gap);
+        size_t const firstLineLen = std::min(text.find_first_of("\r\n"), text.length());
+        bool const isMultiline = firstLineLen < text.length();
+        bool const keepsIndent = is_directive(type) || (type == TokenType::COMMENT_MULTILINE && isMultiline);
+
+        Item item{};
+        item.gapBegin = m_prevEnd;
+        item.tokBegin = begin;
+        item.tokEnd = end;
+        item.type = type;
+        // a comment may run past the end of the line, it never causes a break
+        item.width = type == TokenType::COMMENT_SINGLELINE ? 0 : static_cast<uint32_t>(firstLineLen);
+        item.startWidth = m_runWidth;
+        item.breakSize = s_unknownSize;
+
+        if (m_isFirst) {
+          item.gapKind = keepsIndent ? GapKind::KEEP_INDENT : GapKind::NEWLINES;
+        } else if (m_prevType == TokenType::SPECIAL_LINE_CONT || type == TokenType::SPECIAL_LINE_CONT) {
+          item.gapKind = GapKind::VERBATIM;
+        } else if (numNewlines > 0) {
+          item.gapKind = keepsIndent ? GapKind::KEEP_INDENT : GapKind::NEWLINES;
+          item.numNewlines = static_cast<uint8_t>(std::min<size_t>(numNewlines, 2));
+        } else if (is_comment(type)) {
+          // trailing comments keep their alignment
+          item.gapKind = GapKind::VERBATIM;
+        } else {
+          item.gapKind = m_breakAfterPrev ? GapKind::BREAK : GapKind::FLAT;
+          item.numSpaces = spaces_between(m_prevType, type, !gap.empty());
+        }
+
+        uint64_t const seq = m_baseSeq + m_queue.size();
+        if (item.gapKind == GapKind::BREAK) {
+          terminate_breaks(m_openTypes.size(), item.startWidth);
+          m_scanStack.push_back({ seq, m_openTypes.size() });
+        } else if (item.gapKind != GapKind::FLAT) {
+          terminate_breaks(0, item.startWidth);
+        }
+
+        m_queue.push_back(item);
+        if (item.gapKind == GapKind::FLAT || item.gapKind == GapKind::BREAK)
+          m_runWidth += item.numSpaces;
+        m_runWidth += item.width;
+
+        if (is_opener(type)) {
+          m_openTypes.push_back(type);
+        } else if (is_closer(type) && !m_openTypes.empty() && closes(type, m_openTypes.back())) {
+          // the group ends here, so do the sizes of the breaks inside it
+          terminate_breaks(m_openTypes.size(), m_runWidth);
+          m_openTypes.pop_back();
+        }
+
+        if (isMultiline)
+          terminate_breaks(0, m_runWidth);
+
+        bool const inArguments = !m_openTypes.empty() && (
+          m_openTypes.back() == TokenType::SPECIAL_PAREN_OPEN ||
+          m_openTypes.back() == TokenType::SPECIAL_BRACKET_OPEN);
+        m_breakAfterPrev =
+          (type == TokenType::SPECIAL_COMMA && inArguments) ||
+          type == TokenType::OPER_LOGIC_AND ||
+          type == TokenType::OPER_LOGIC_OR;
+
+        m_prevType = type;
+        m_prevEnd = end;
+        m_isFirst = false;
+
+        flush();
+      }
+
+      // Sets the size of the pending breaks at `minDepth` or deeper, they reach up to `endWidth`.
+      void terminate_breaks(size_t const minDepth, uint64_t const endWidth) {
+        while (!m_scanStack.empty() && m_scanStack.back().depth >= minDepth) {
+          PendingBreak const pending = m_scanStack.back();
+          m_scanStack.pop_back();
+
+          // may have been decided already because it couldn't possibly fit
+          if (pending.seq < m_baseSeq + m_head)
+            continue;
+
+          Item &item = m_queue[pending.seq - m_baseSeq];
+          item.breakSize = endWidth - item.startWidth;
+        }
+      }
+
+      // output side, prints everything which can be decided
+
+      void flush() {
+        while (m_head < m_queue.size()) {
+          Item &item = m_queue[m_head];
+
+          if (item.gapKind == GapKind::BREAK && item.breakSize == s_unknownSize) {
+            // the size isn't known yet, but once what's pending doesn't fit it never will
+            uint64_t const pendingWidth = m_runWidth - item.startWidth;
+            if (m_column + pendingWidth <= m_options.maxLineLen)
+              break;
+            item.breakSize = pendingWidth;
+          }
+
+          print(item);
+          ++m_head;
+        }
+
+        if (m_head == m_queue.size()) {
+          m_baseSeq += m_head;
+          m_queue.clear();
+          m_head = 0;
+        } else if (m_head >= 1024 && m_head * 2 >= m_queue.size()) {
+          m_queue.erase(m_queue.begin(), m_queue.begin() + static_cast<ptrdiff_t>(m_head));
+          m_baseSeq += m_head;
+          m_head = 0;
+        }
+      }
+
+      void print(Item const &item) {
+        std::string_view const gap = m_source.substr(item.gapBegin, item.tokBegin - item.gapBegin);
+        m_whitespace.clear();
+
+        bool isReindented = false;
+        uint32_t indent = 0;
+
+        switch (item.gapKind) {
+          case GapKind::FLAT:
+            m_whitespace.append(item.numSpaces, ' ');
+            break;
+
+          case GapKind::BREAK:
+            indent = indent_for(item.type);
+            // breaking only helps when the next line starts further left
+            if (m_column + item.breakSize > m_options.maxLineLen && m_column > indent) {
+              m_whitespace += m_newline;
+              m_whitespace.append(indent, ' ');
+              isReindented = true;
+            } else {
+              m_whitespace.append(item.numSpaces, ' ');
+            }
+            break;
+
+          case GapKind::NEWLINES:
+            for (size_t i = 0; i < item.numNewlines; ++i)
+              m_whitespace += m_newline;
+            indent = indent_for(item.type);
+            m_whitespace.append(indent, ' ');
+            isReindented = true;
+            break;
+
+          case GapKind::KEEP_INDENT: {
+            for (size_t i = 0; i < item.numNewlines; ++i)
+              m_whitespace += m_newline;
+            size_t const lastNewline = gap.find_last_of("\r\n");
+            m_whitespace += lastNewline == std::string_view::npos ? gap : gap.substr(lastNewline + 1);
+            break;
+          }
+
+          default:
+            m_whitespace = gap;
+            break;
+        }
+
+        if (!m_isReplaying)
+          m_sink.on_gap(item.gapBegin, item.tokBegin, m_whitespace);
+
+        size_t const lastNewline = m_whitespace.find_last_of("\r\n");
+        if (lastNewline == std::string::npos) {
+          m_column += m_whitespace.length();
+        } else {
+          m_column = m_whitespace.length() - lastNewline - 1;
+          m_lineIndent = static_cast<uint32_t>(m_column);
+        }
+
+        if (isReindented)
+          begin_line(item.type, indent);
+
+        std::string_view const text = m_source.substr(item.tokBegin, item.tokEnd - item.tokBegin);
+        size_t const lastTokNewline = text.find_last_of("\r\n");
+        m_column = lastTokNewline == std::string_view::npos
+          ? m_column + text.length()
+          : text.length() - lastTokNewline - 1;
+
+        on_printed(item.type);
+      }
+
+      bool is_continuation(TokenType const firstType) const {
+        if (!m_hasCode)
+          return false;
+
+        switch (m_lastCode) {
+          case TokenType::SPECIAL_COMMA:
+            // e.g. member initializer lists, but not the enumerators of an enum
+            return m_isContinuationLine;
+          case TokenType::SPECIAL_SEMICOLON:
+          case TokenType::SPECIAL_BRACE_OPEN:
+          case TokenType::SPECIAL_BRACE_CLOSE:
+            return false;
+          default:
+            return leaves_expression_open(m_lastCode) || continues_expression(firstType);
+        }
+      }
+
+      uint32_t indent_for(TokenType const firstType) const {
+        uint32_t const width = m_options.indentWidth;
+
+        if (!m_opens.empty()) {
+          Open const &top = m_opens.back();
+          if (closes(firstType, top.type))
+            return top.lineIndent;
+          if (top.type != TokenType::SPECIAL_BRACE_OPEN)
+            return opens_line_group(top) ? top.lineIndent + width : top.innerIndent;
+        }
+
+        uint32_t blockIndent = 0;
+        if (!m_opens.empty()) {
+          // statements after a case label go one level deeper than the label
+          Open const &top = m_opens.back();
+          blockIndent = top.innerIndent;
+          if (top.hasCaseLabel && !is_case_label(firstType))
+            blockIndent += width;
+        }
+
+        if (is_continuation(firstType))
+          return m_stmtIndent + 2 * width;
+        if (m_controlPending && firstType != TokenType::SPECIAL_BRACE_OPEN)
+          return blockIndent + width;
+        return blockIndent;
+      }
+
+      // True if `open` is a paren/bracket ending the line before the one about to start,
+      // its contents go one level deeper than that line rather than being a continuation.
+      bool opens_line_group(Open const &open) const {
+        return m_hasCode && m_lastCode == open.type && open.type != TokenType::SPECIAL_BRACE_OPEN;
+      }
+
+      void begin_line(TokenType const firstType, uint32_t const indent) {
+        if (!m_opens.empty() && opens_line_group(m_opens.back()) && !closes(firstType, m_opens.back().type))
+          m_opens.back().innerIndent = indent;
+
+        m_lineIndent = indent;
+
+        bool const inBlock = m_opens.empty() || m_opens.back().type == TokenType::SPECIAL_BRACE_OPEN;
+        m_isContinuationLine = inBlock && is_continuation(firstType);
+        if (inBlock && !m_isContinuationLine)
+          m_stmtIndent = indent;
+        // only at the start of a line, `= default` isn't a label
+        if (inBlock && !m_opens.empty() && is_case_label(firstType))
+          m_opens.back().hasCaseLabel = true;
+      }
+
+      void on_printed(TokenType const type) {
+        if (is_comment(type) || is_directive(type))
+          return;
+
+        uint32_t const width = m_options.indentWidth;
+        bool isControl = false;
+
+        switch (type) {
+          case TokenType::SPECIAL_PAREN_OPEN:
+          case TokenType::SPECIAL_BRACKET_OPEN:
+            m_opens.push_back({
+              type,
+              m_lineIndent,
+              m_lineIndent + 2 * width,
+              type == TokenType::SPECIAL_PAREN_OPEN && m_hasCode && is_control_keyword(m_lastCode),
+              false,
+            });
+            break;
+
+          case TokenType::SPECIAL_BRACE_OPEN: {
+            // blocks are indented relative to the statement they belong to, lambdas
+            // and initializer lists inside parens relative to the line they're on
+            bool const inBlock = m_opens.empty() || m_opens.back().type == TokenType::SPECIAL_BRACE_OPEN;
+            uint32_t const base = inBlock ? m_stmtIndent : m_lineIndent;
+            m_opens.push_back({ type, base, base + width, false, false });
+            break;
+          }
+
+          case TokenType::SPECIAL_PAREN_CLOSE:
+          case TokenType::SPECIAL_BRACKET_CLOSE:
+          case TokenType::SPECIAL_BRACE_CLOSE:
+            if (!m_opens.empty() && closes(type, m_opens.back().type)) {
+              isControl = m_opens.back().isControl;
+              m_opens.pop_back();
+            }
+            break;
+
+          case TokenType::KEYWORD_ELSE:
+          case TokenType::KEYWORD_DO:
+            isControl = true;
+            break;
+
+          default:
+            break;
+        }
+
+        m_controlPending = isControl;
+        m_lastCode = type;
+        m_hasCode = true;
+      }
+
+      std::string_view const m_source;
+      size_t const m_end;
+      fmtcpp::FormatOptions const &m_options;
+      fmtcpp::GapSink &m_sink;
+      char const *m_newline = "\n";
+
+      // input side
+      std::pmr::vector<Item> m_queue;
+      size_t m_head = 0;    // first item which isn't printed yet
+      uint64_t m_baseSeq = 0; // sequence number of m_queue[0]
+      std::pmr::vector<PendingBreak> m_scanStack;
+      std::pmr::vector<TokenType> m_openTypes;
+      uint64_t m_runWidth = 0;
+      uint32_t m_prevEnd;
+      TokenType m_prevType = TokenType::NIL;
+      bool m_breakAfterPrev = false;
+      bool m_isFirst = true;
+
+      // output side
+      std::pmr::vector<Open> m_opens;
+      std::pmr::string m_whitespace;
+      size_t m_column = 0;
+      uint32_t m_lineIndent = 0;
+      uint32_t m_stmtIndent = 0;
+      TokenType m_lastCode = TokenType::NIL;
+      bool m_hasCode = false;
+      bool m_controlPending = false;
+      bool m_isContinuationLine = false;
+      bool m_isReplaying = false;
+  };
+
+} // namespace
+
+void fmtcpp::format_gaps(
+  std::string_view const source,
+  FormatOptions const &options,
+  util::Arena &scratch,
+  GapSink &sink
+) {
+  Formatter formatter(source, 0, source.length(), options, scratch, sink);
+  formatter.run();
+}
+
+namespace {
+
+  // scope of the boundaries outside of any block
+  constexpr size_t s_topLevel = SIZE_MAX;
+
+  // statements starting at a boundary which may open a block whose lines are boundaries too
+  enum class Header : uint8_t {
+    NONE,
+    START,     // the statement starts at a boundary, with the next token
+    INLINE,    // `inline`, maybe followed by `namespace`
+    EXTERN,    // `extern`, maybe followed by a linkage
+    LINKAGE,   // `extern "C"`, a block if a '{' follows
+    NAMESPACE, // `namespace` (or `inline namespace`), up to its '{'
+  };
+
+  bool is_declaration_start(TokenType const type) {
+    return type == TokenType::IDENTIFIER || (type >= TokenType::KEYWORD_BOOL && type <= TokenType::KEYWORD_WHILE);
+  }
+
+  // Walks the tokens of a source from one of its boundaries (see BoundaryIndex), stopping at the
+  // following ones. Only braces, parens and brackets are tracked, along with the namespace and
+  // `extern "C"` blocks around the current position.
+  class BoundaryScanner {
+    public:
+      // `scopes` are the boundaries starting the blocks around `boundary`, outermost first.
+      BoundaryScanner(std::string_view const source, size_t const boundary, std::vector<size_t> scopes)
+      : m_source{source},
+        m_pos{boundary},
+        m_lineStart{boundary},
+        m_boundary{boundary},
+        m_scopes{std::move(scopes)}
+      {}
+
+      // The next boundary, the end of the source once there are no more.
+      size_t next() {
+        char const *const text = m_source.data();
+        size_t const textLen = m_source.length();
+
+        while (m_pos < textLen) {
+          lexer::Token const tok = lexer::detail::extract_token(text, textLen, m_pos);
+          TokenType const type = tok.type();
+          if (type == TokenType::NIL)
+            break;
+
+          bool const startsLine = m_isLineStart;
+          bool const isBoundary =
+            startsLine && m_lineStart != m_boundary && m_depth == 0 && is_declaration_start(type) &&
+            (m_lastCode == TokenType::NIL || m_lastCode == TokenType::SPECIAL_SEMICOLON ||
+              m_lastCode == TokenType::SPECIAL_BRACE_OPEN || m_lastCode == TokenType::SPECIAL_BRACE_CLOSE);
+          if (isBoundary) {
+            // the token is lexed again by the next call, as the first one of a statement
+            m_boundary = m_lineStart;
+            return m_boundary;
+          }
+
+          m_pos = tok.position() + tok.length();
+          m_isLineStart = type == TokenType::NEWLINE;
+
+          if (m_isBlockPending) {
+            // a block only has boundaries inside if its '{' ends the line
+            m_isBlockPending = false;
+            if (m_isLineStart || type == TokenType::COMMENT_SINGLELINE)
+              m_scopes.push_back(m_stmtStart);
+            else
+              ++m_depth;
+          }
+
+          if (m_isLineStart) {
+            m_lineStart = m_pos;
+            continue;
+          }
+          if (is_comment(type) || is_directive(type))
+            continue;
+
+          if (type == TokenType::SPECIAL_BRACE_OPEN && m_depth == 0 &&
+              (m_header == Header::NAMESPACE || m_header == Header::LINKAGE)) {
+            m_isBlockPending = true;
+          } else if (is_opener(type)) {
+            ++m_depth;
+          } else if (is_closer(type)) {
+            if (m_depth > 0)
+              --m_depth;
+            else if (type == TokenType::SPECIAL_BRACE_CLOSE && !m_scopes.empty())
+              m_scopes.pop_back();
+          }
+
+          if (startsLine && m_lineStart == m_boundary) {
+            m_stmtStart = m_boundary;
+            m_header = Header::START;
+          }
+          m_header = header_after(m_header, tok);
+          m_lastCode = type;
+        }
+
+        m_pos = textLen;
+        return textLen;
+      }
+
+      // Boundaries starting the blocks around the last one returned, outermost first.
+      std::vector<size_t> const &scopes() const noexcept {
+        return m_scopes;
+      }
+
+      // The innermost of them, s_topLevel if there's none.
+      size_t scope() const noexcept {
+        return m_scopes.empty() ? s_topLevel : m_scopes.back();
+      }
+
+    private:
+      Header header_after(Header const header, lexer::Token const &tok) const {
+        TokenType const type = tok.type();
+        bool const isNamespace = type == TokenType::IDENTIFIER && m_source.substr(tok.position(), tok.length()) == "namespace";
+
+        switch (header) {
+          case Header::START:
+            if (isNamespace)
+              return Header::NAMESPACE;
+            if (type == TokenType::KEYWORD_INLINE)
+              return Header::INLINE;
+            return type == TokenType::KEYWORD_EXTERN ? Header::EXTERN : Header::NONE;
+          case Header::INLINE:
+            return isNamespace ? Header::NAMESPACE : Header::NONE;
+          case Header::EXTERN:
+            return type == TokenType::LITERAL_STR ? Header::LINKAGE : Header::NONE;
+          case Header::NAMESPACE:
+            return type == TokenType::SPECIAL_SEMICOLON || type == TokenType::SPECIAL_BRACE_OPEN ? Header::NONE : header;
+          default:
+            return Header::NONE;
+        }
+      }
+
+      std::string_view const m_source;
+      size_t m_pos;
+      size_t m_lineStart;
+      bool m_isLineStart = true;
+      size_t m_boundary;  // the last one returned, or where the walk started
+      size_t m_stmtStart = 0;
+      size_t m_depth = 0; // of parens/brackets/braces other than those of blocks
+      TokenType m_lastCode = TokenType::NIL;
+      Header m_header = Header::NONE;
+      bool m_isBlockPending = false;
+      std::vector<size_t> m_scopes;
+  };
+
+} // namespace
+
+fmtcpp::BoundaryIndex::BoundaryIndex(std::string_view const source)
+: m_sourceLen{source.length()}
+{
+  m_entries.push_back({ 0, s_topLevel });
+
+  BoundaryScanner scanner(source, 0, {});
+  for (size_t boundary = scanner.next(); boundary < source.length(); boundary = scanner.next())
+    m_entries.push_back({ boundary, scanner.scope() });
+}
+
+void fmtcpp::BoundaryIndex::update(
+  std::string_view const source,
+  size_t const offset,
+  size_t const oldLen,
+  size_t const newLen
+) {
+  // the edit may change the first token of the boundary before it, not the one of the boundary before that
+  size_t resume = static_cast<size_t>(find(offset) - m_entries.begin());
+  if (resume > 0)
+    --resume;
+
+  auto const isUnchanged = [offset, oldLen](size_t const pos) {
+    return pos < offset || pos >= offset + oldLen;
+  };
+  auto const moved = [offset, oldLen, newLen](size_t const pos) {
+    return pos < offset ? pos : pos - oldLen + newLen;
+  };
+
+  // once the scanner passes the edit and reaches an old boundary in the same state as before,
+  // the old boundaries from there on still hold
+  size_t old = resume + 1;
+  while (old < m_entries.size() && m_entries[old].pos < offset + oldLen)
+    ++old;
+  auto const isInStep = [&](size_t const boundary, std::vector<size_t> const &scopes) {
+    while (old < m_entries.size() && moved(m_entries[old].pos) < boundary)
+      ++old;
+    if (old == m_entries.size() || moved(m_entries[old].pos) != boundary)
+      return false;
+    std::vector<size_t> const oldScopes = enclosing(m_entries[old].pos);
+    return std::equal(oldScopes.begin(), oldScopes.end(), scopes.begin(), scopes.end(),
+      [&](size_t const oldScope, size_t const scope) { return isUnchanged(oldScope) && moved(oldScope) == scope; });
+  };
+
+  std::vector<Entry> relexed{};
+  BoundaryScanner scanner(source, m_entries[resume].pos, enclosing(m_entries[resume].pos));
+  size_t boundary = scanner.next();
+  for (; boundary < source.length(); boundary = scanner.next()) {
+    if (boundary >= offset + newLen && isInStep(boundary, scanner.scopes()))
+      break;
+    relexed.push_back({ boundary, scanner.scope() });
+  }
+  if (boundary >= source.length())
+    old = m_entries.size();
+
+  for (size_t i = old; i < m_entries.size(); ++i) {
+    m_entries[i].pos = moved(m_entries[i].pos);
+    if (m_entries[i].scope != s_topLevel)
+      m_entries[i].scope = moved(m_entries[i].scope);
+  }
+  auto const replaced = m_entries.begin() + static_cast<ptrdiff_t>(resume) + 1;
+  m_entries.insert(m_entries.erase(replaced, m_entries.begin() + static_cast<ptrdiff_t>(old)), relexed.begin(), relexed.end());
+  m_sourceLen = source.length();
+}
+
+std::vector<fmtcpp::BoundaryIndex::Entry>::const_iterator fmtcpp::BoundaryIndex::find(size_t const boundary) const {
+  // the first entry always is the start of the source
+  return std::prev(std::upper_bound(m_entries.begin(), m_entries.end(), boundary,
+    [](size_t const pos, Entry const &entry) { return pos < entry.pos; }));
+}
+
+size_t fmtcpp::BoundaryIndex::before(size_t const pos) const {
+  return find(pos)->pos;
+}
+
+size_t fmtcpp::BoundaryIndex::after(size_t const pos) const {
+  auto const next = std::lower_bound(m_entries.begin(), m_entries.end(), pos,
+    [](Entry const &entry, size_t const value) { return entry.pos < value; });
+  return next == m_entries.end() ? m_sourceLen : next->pos;
+}
+
+std::vector<size_t> fmtcpp::BoundaryIndex::enclosing(size_t const boundary) const {
+  std::vector<size_t> scopes{};
+  for (size_t scope = find(boundary)->scope; scope != s_topLevel; scope = find(scope)->scope)
+    scopes.push_back(scope);
+  std::reverse(scopes.begin(), scopes.end());
+  return scopes;
+}
+
+void fmtcpp::format_gaps(
+  std::string_view const source,
+  BoundaryIndex const &boundaries,
+  size_t const begin,
+  size_t const end,
+  FormatOptions const &options,
+  util::Arena &scratch,
+  GapSink &sink
+) {
+  Formatter formatter(source, begin, end, options, scratch, sink);
+  // a block's first lines end where the boundary after its start is
+  for (size_t const scope : boundaries.enclosing(begin))
+    formatter.replay(scope, boundaries.after(scope + 1));
+  formatter.run();
+}
@@ -0,0 +1,103 @@
+#ifndef FMTCPP_FORMATTER_HPP
+#define FMTCPP_FORMATTER_HPP
+
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "fmtcpp.hpp"
+
+namespace fmtcpp {
+
+// Receives the decisions of `format_gaps`.
+class GapSink {
+  public:
+    virtual ~GapSink() = default;
+
+    // The whitespace at [begin, end) of the source is to become `whitespace`.
+    // Called in source order, `whitespace` is only valid during the call.
+    virtual void on_gap(size_t begin, size_t end, std::string_view whitespace) = 0;
+
+    // Polled between tokens, once true formatting stops without reporting the remaining gaps.
+    virtual bool is_done() const { return false; }
+};
+
+// The formatting engine behind `format_source_code`. Formatting only ever changes
+// whitespace, the text of every token (comments, directives, literals...) is kept
+// verbatim, so the engine reports one decision per gap between two tokens, plus
+// the gaps before the first and after the last token.
+//
+// It is a single pass over the token stream: tokens are pulled from the lexer one
+// at a time and line breaking follows Oppen's algorithm, where a break opportunity
+// (after a ',' inside parens/brackets, after '&&' and '||') is taken when the text
+// up to the next opportunity at the same nesting level doesn't fit on the line.
+// Only the tokens since the oldest undecided opportunity are held, at most about
+// a line's worth unless a single unbreakable stretch is longer.
+//
+// Rules:
+// - lines are indented by brace depth, continuations (open parens, lines
+//   starting or ending in a binary operator) and the bodies of brace-less
+//   if/for/while/else/do get extra indentation
+// - existing line breaks are kept, runs of blank lines shrink to one
+// - within a line, whitespace shrinks to a single space (or none: before , ; ) ]
+//   and after ( [), ',' and ';' are followed by a space
+// - trailing whitespace is removed and the output ends in exactly one newline
+// - directives and comments spanning several lines keep their indentation,
+//   trailing comments keep their distance to the code before them
+// Formatting formatted code changes nothing.
+void format_gaps(std::string_view source, FormatOptions const &options, util::Arena &scratch, GapSink &sink);
+
+// The lines of a source where formatting can start from scratch, i.e. (by a heuristic, no parsing
+// is done) those starting a declaration at the top level or directly inside a namespace or
+// `extern "C"` block: outside of any other paren, bracket or brace, their first token is a keyword
+// or identifier, and the last token before it other than comments and directives is a ';', a '}'
+// or the '{' of such a block (which must end its line). Boundaries are line starts, the start of
+// the source always is one.
+//
+// Building the index lexes the whole source once. After an edit, `update` relexes only from the
+// boundary before it until the boundaries line up with the old ones again, so an editor keeping
+// the index of an open file never has it lexed from the start again.
+class BoundaryIndex {
+  public:
+    explicit BoundaryIndex(std::string_view source);
+
+    // `source` is the edited text, in which `newLen` bytes at `offset` replaced `oldLen` ones.
+    void update(std::string_view source, size_t offset, size_t oldLen, size_t newLen);
+
+    // The closest boundary at or before `pos`.
+    size_t before(size_t pos) const;
+
+    // The closest boundary at or after `pos`, the end of the source if there's none.
+    size_t after(size_t pos) const;
+
+    // The boundaries starting the namespace and `extern "C"` blocks around `boundary`, outermost first.
+    std::vector<size_t> enclosing(size_t boundary) const;
+
+  private:
+    struct Entry {
+      size_t pos;
+      size_t scope; // boundary of the innermost block around it, SIZE_MAX at the top level
+    };
+
+    std::vector<Entry>::const_iterator find(size_t boundary) const;
+
+    std::vector<Entry> m_entries{};
+    size_t m_sourceLen = 0;
+};
+
+// Same as the first format_gaps, restricted to [begin, end) of `source`, which must both be
+// boundaries of it. Only that part is lexed, plus the first lines of the blocks around it (see
+// BoundaryIndex::enclosing) for their indentation. Offsets passed to `sink` are still into `source`.
+void format_gaps(
+  std::string_view source,
+  BoundaryIndex const &boundaries,
+  size_t begin,
+  size_t end,
+  FormatOptions const &options,
+  util::Arena &scratch,
+  GapSink &sink
+);
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_FORMATTER_HPP
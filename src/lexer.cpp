@@ -1,11 +1,14 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <algorithm>
 #include <stdexcept>
 #include <string_view>
 #include <cstring>
-#include <unordered_map>
+#include <functional>
+#include <thread>
 
 #include "lexer.hpp"
+#include "scan.hpp"
 #include "util.hpp"
 
 lexer::Token::Token(TokenType const type, uint32_t const pos, uint32_t const len)
@@ -41,76 +44,484 @@ namespace lexer {
   }
 }
 
-std::vector<lexer::Token> lexer::tokenize_text(char const *const text, size_t const textLen) {
+void lexer::TokenBuffer::push_back(Token const &tok) {
+  if (tok.length() >= s_longLength) {
+    m_longLengths.emplace_back(static_cast<uint32_t>(m_types.size()), tok.length());
+    m_lengths.push_back(s_longLength);
+  } else {
+    m_lengths.push_back(static_cast<uint8_t>(tok.length()));
+  }
+  m_types.push_back(tok.type());
+  m_positions.push_back(tok.position());
+}
+
+void lexer::TokenBuffer::reserve(size_t const numTokens) {
+  m_types.reserve(numTokens);
+  m_positions.reserve(numTokens);
+  m_lengths.reserve(numTokens);
+}
+
+void lexer::TokenBuffer::clear() noexcept {
+  m_types.clear();
+  m_positions.clear();
+  m_lengths.clear();
+  m_longLengths.clear();
+}
+
+size_t lexer::TokenBuffer::size() const noexcept { return m_types.size(); }
+bool lexer::TokenBuffer::empty() const noexcept { return m_types.empty(); }
+
+lexer::TokenType lexer::TokenBuffer::type(size_t const idx) const noexcept { return m_types[idx]; }
+uint32_t lexer::TokenBuffer::position(size_t const idx) const noexcept { return m_positions[idx]; }
+
+uint32_t lexer::TokenBuffer::length(size_t const idx) const {
+  if (m_lengths[idx] != s_longLength)
+    return m_lengths[idx];
+
+  auto const entry = std::lower_bound(
+    m_longLengths.begin(), m_longLengths.end(), idx,
+    [](std::pair<uint32_t, uint32_t> const &lhs, size_t const rhs) { return lhs.first < rhs; });
+  return entry->second;
+}
+
+lexer::Token lexer::TokenBuffer::operator[](size_t const idx) const {
+  return { m_types[idx], m_positions[idx], length(idx) };
+}
+
+std::vector<lexer::TokenType> const &lexer::TokenBuffer::types() const noexcept { return m_types; }
+std::vector<uint32_t> const &lexer::TokenBuffer::positions() const noexcept { return m_positions; }
+
+std::vector<lexer::Token> lexer::TokenBuffer::to_vector() const {
+  std::vector<Token> tokens{};
+  tokens.reserve(size());
+  for (size_t i = 0; i < size(); ++i)
+    tokens.push_back((*this)[i]);
+  return tokens;
+}
+
+// Shared by all `tokenize_text`s, `Tokens` is a (pmr) vector of Token or a TokenBuffer.
+// Directives also go to `prepro` unless it's nullptr.
+template <typename Tokens>
+static
+void tokenize_into(char const *const text, size_t const textLen, Tokens &tokens, lexer::PreproIndex *const prepro = nullptr) {
   using lexer::TokenType;
   using lexer::Token;
 
+  // rather than guessing a token density up front, lex a prefix of the text
+  // and extrapolate the density measured there to the rest of it
+  size_t constexpr sampleLen = 4096;
+  size_t const firstToken = tokens.size();
+  bool reserved = textLen <= sampleLen;
+  if (reserved)
+    tokens.reserve(firstToken + textLen / 2 + 1);
+
+  // single pass, encoding prefixes (L"", u8'', R"()" etc.) are
+  // folded into their literal by `extract_token`
+  size_t pos = 0;
+  while (pos < textLen) {
+    Token const tok = lexer::detail::extract_token(text, textLen, pos);
+    if (tok.type() == TokenType::NIL)
+      break;
+
+    pos += tok.length();
+    tokens.push_back(tok);
+    if (prepro != nullptr)
+      prepro->add(tok, text);
+
+    if (!reserved && pos >= sampleLen) {
+      size_t const numSampled = tokens.size() - firstToken;
+      // 1/8 headroom so a slightly denser remainder doesn't cause a regrowth
+      size_t const estimate = numSampled * textLen / pos;
+      tokens.reserve(firstToken + estimate + estimate / 8);
+      reserved = true;
+    }
+  }
+}
+
+std::vector<lexer::Token> lexer::tokenize_text(char const *const text, size_t const textLen) {
   std::vector<Token> tokens{};
+  tokenize_into(text, textLen, tokens);
+  return tokens;
+}
 
-  // not very scientific, but from experimentation seems reasonable
-  tokens.reserve(textLen / 3);
+std::vector<lexer::Token> lexer::tokenize_text(char const *const text, size_t const textLen, PreproIndex &prepro) {
+  std::vector<Token> tokens{};
+  tokenize_into(text, textLen, tokens, &prepro);
+  prepro.finish(textLen);
+  return tokens;
+}
 
-  // first pass, collection phase
-  {
-    size_t pos = 0;
-    while (pos < textLen) {
-      Token const tok = detail::extract_token(text, textLen, pos);
-      if (tok.type() == TokenType::NIL)
-        break;
-      else {
-        pos += tok.length();
-        tokens.push_back(tok);
+void lexer::tokenize_text(char const *const text, size_t const textLen, TokenBuffer &out) {
+  tokenize_into(text, textLen, out);
+}
+
+std::pmr::vector<lexer::Token> lexer::tokenize_text(
+  char const *const text,
+  size_t const textLen,
+  std::pmr::memory_resource &memory
+) {
+  std::pmr::vector<Token> tokens(&memory);
+  tokenize_into(text, textLen, tokens);
+  return tokens;
+}
+
+// The first word after the directive's name, e.g. "NAME" of "#  define NAME(x) ...".
+static
+std::string_view directive_operand(std::string_view const directive) {
+  size_t pos = directive.find_first_not_of(" \t", 1);
+  while (pos < directive.length() && util::is_alphabetic(directive[pos]))
+    ++pos;
+  while (pos < directive.length() && util::is_non_newline_whitespace(directive[pos]))
+    ++pos;
+
+  size_t const begin = std::min(pos, directive.length());
+  while (pos < directive.length() && (util::is_alphabetic(directive[pos]) || util::is_digit(directive[pos]) || directive[pos] == '_'))
+    ++pos;
+
+  return directive.substr(begin, pos - begin);
+}
+
+// "x.h" or <x.h> of an #include, empty if it's neither (e.g. a macro).
+static
+std::string_view included_path(std::string_view const directive) {
+  size_t const open = directive.find_first_of("\"<");
+  if (open == std::string_view::npos)
+    return {};
+  size_t const close = directive.find(directive[open] == '<' ? '>' : '"', open + 1);
+  if (close == std::string_view::npos)
+    return {};
+  return directive.substr(open, close - open + 1);
+}
+
+void lexer::PreproIndex::add(Token const &tok, char const *const text) {
+  TokenType const type = tok.type();
+  if (type < TokenType::PREPRO_DIR_INCLUDE || type > TokenType::PREPRO_DIR_PRAGMA)
+    return;
+
+  m_directives.push_back(tok);
+  uint32_t const begin = tok.position();
+  uint32_t const end = begin + tok.length();
+  std::string_view const directive(text + begin, tok.length());
+
+  switch (type) {
+    case TokenType::PREPRO_DIR_IF:
+    case TokenType::PREPRO_DIR_IFDEF:
+    case TokenType::PREPRO_DIR_IFNDEF:
+      m_conditionals.push_back({ begin, NONE, m_open.empty() ? NONE : m_open.back(), {} });
+      m_open.push_back(static_cast<uint32_t>(m_conditionals.size() - 1));
+      break;
+
+    case TokenType::PREPRO_DIR_ELIF:
+    case TokenType::PREPRO_DIR_ELSE:
+      // a stray one (e.g. formatting a range inside a conditional) belongs to nothing
+      if (!m_open.empty())
+        m_conditionals[m_open.back()].branches.push_back(begin);
+      break;
+
+    case TokenType::PREPRO_DIR_ENDIF:
+      if (!m_open.empty()) {
+        Conditional &conditional = m_conditionals[m_open.back()];
+        conditional.branches.push_back(begin);
+        conditional.end = end;
+        m_open.pop_back();
       }
+      break;
+
+    case TokenType::PREPRO_DIR_DEFINE: {
+      std::string_view const name = directive_operand(directive);
+      if (!name.empty())
+        m_defines.push_back({ std::string(name), begin, end });
+      break;
+    }
+
+    case TokenType::PREPRO_DIR_INCLUDE: {
+      std::string_view const path = included_path(directive);
+      if (!path.empty())
+        m_includes.push_back({ std::string(path), begin, end });
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void lexer::PreproIndex::finish(size_t const textLen) {
+  for (uint32_t const idx : m_open)
+    m_conditionals[idx].end = static_cast<uint32_t>(textLen);
+  m_open.clear();
+}
+
+std::vector<lexer::Token> const &lexer::PreproIndex::directives() const noexcept { return m_directives; }
+std::vector<lexer::PreproIndex::Conditional> const &lexer::PreproIndex::conditionals() const noexcept { return m_conditionals; }
+std::vector<lexer::PreproIndex::Define> const &lexer::PreproIndex::defines() const noexcept { return m_defines; }
+std::vector<lexer::PreproIndex::Include> const &lexer::PreproIndex::includes() const noexcept { return m_includes; }
+
+uint32_t lexer::PreproIndex::conditional_at(uint32_t const pos) const {
+  // the last one opening at or before `pos`, or one enclosing it
+  auto const after = std::upper_bound(m_conditionals.begin(), m_conditionals.end(), pos,
+    [](uint32_t const p, Conditional const &conditional) { return p < conditional.begin; });
+  if (after == m_conditionals.begin())
+    return NONE;
+
+  auto idx = static_cast<uint32_t>(after - m_conditionals.begin() - 1);
+  while (idx != NONE && m_conditionals[idx].end <= pos)
+    idx = m_conditionals[idx].parent;
+  return idx;
+}
+
+uint32_t lexer::PreproIndex::branch_end(uint32_t const idx, uint32_t const pos) const {
+  Conditional const &conditional = m_conditionals[idx];
+  auto const next = std::upper_bound(conditional.branches.begin(), conditional.branches.end(), pos);
+  return next == conditional.branches.end() ? conditional.end : *next;
+}
+
+namespace {
+
+  // tokens of one chunk of `tokenize_chunks`, lexed from a guessed start
+  struct Chunk {
+    std::vector<lexer::Token> tokens{};
+    size_t end = 0;       // where lexing stopped, the position after the last token
+    bool isLast = false;  // the text ends within the chunk, or has a character the lexer doesn't know
+  };
+
+} // namespace
+
+// Lexes the tokens starting in [begin, end), the last one may run past `end`.
+static
+void lex_chunk(char const *const text, size_t const textLen, size_t const begin, size_t const end, Chunk &out) {
+  size_t pos = begin;
+  while (pos < textLen) {
+    lexer::Token const tok = lexer::detail::extract_token(text, textLen, pos);
+    if (tok.type() == lexer::TokenType::NIL)
+      break;
+    // `pos` is at the token, the next chunk starts there
+    if (pos >= end) {
+      out.end = pos;
+      return;
     }
+
+    pos += tok.length();
+    out.tokens.push_back(tok);
+  }
+
+  out.end = pos;
+  out.isLast = true;
+}
+
+std::vector<lexer::Token> lexer::detail::tokenize_chunks(char const *const text, size_t const textLen, size_t const numChunks) {
+  if (numChunks <= 1)
+    return tokenize_text(text, textLen);
+
+  // even splits moved to the next line start, most lines don't start inside a comment or literal
+  std::vector<size_t> starts(numChunks + 1, textLen);
+  starts[0] = 0;
+  for (size_t i = 1; i < numChunks; ++i) {
+    size_t const split = std::max(textLen / numChunks * i, starts[i - 1]);
+    void const *const newline = std::memchr(text + split, '\n', textLen - split);
+    starts[i] = newline == nullptr ? textLen : static_cast<size_t>(static_cast<char const *>(newline) - text) + 1;
+  }
+
+  std::vector<Chunk> chunks(numChunks);
+  {
+    std::vector<std::thread> threads{};
+    threads.reserve(numChunks - 1);
+    for (size_t i = 1; i < numChunks; ++i)
+      threads.emplace_back(lex_chunk, text, textLen, starts[i], starts[i + 1], std::ref(chunks[i]));
+    lex_chunk(text, textLen, 0, starts[1], chunks[0]);
+    for (auto &thread : threads)
+      thread.join();
   }
 
-  // second pass, compression phrase
-  for (size_t i = 0; i < tokens.size();) {
-    switch (tokens[i].type()) {
-      default: {
-        ++i;
+  size_t numTokens = 0;
+  for (auto const &chunk : chunks)
+    numTokens += chunk.tokens.size();
+
+  // the first chunk starts where the text does, its guess can't be wrong
+  std::vector<Token> tokens = std::move(chunks[0].tokens);
+  tokens.reserve(numTokens);
+  size_t pos = chunks[0].end;
+  bool isDone = chunks[0].isLast;
+
+  for (size_t i = 1; i < numChunks && !isDone; ++i) {
+    auto const &spec = chunks[i].tokens;
+    size_t specIdx = 0;
+
+    // re-lex from the end of the tokens so far until one coincides with a token of the chunk
+    while (pos < starts[i + 1]) {
+      size_t const tokStart = pos;
+      Token const tok = extract_token(text, textLen, pos);
+      if (tok.type() == TokenType::NIL) {
+        isDone = true;
+        break;
+      }
+      // past the chunk without meeting any of its tokens, the next one may still be right
+      if (pos >= starts[i + 1]) {
+        pos = tokStart;
         break;
       }
 
-      case TokenType::LITERAL_CHAR:
-      case TokenType::LITERAL_STR: {
-        auto const prevToken = tokens.begin() + ptrdiff_t(i - 1ull);
-        bool const isPrefixed =
-          prevToken->type() == TokenType::IDENTIFIER &&
-          prevToken->length() == 1 &&
-          std::strchr("LuU", text[prevToken->position()]);
-
-        if (isPrefixed) {
-          //   L  'c'
-          //   ^  ^
-          //   |  |
-          // i-1  i
-          // ------
-          // we need to replace tokens [i-1, i] as a single
-          // LITERAL_CHAR
-
-          auto &currToken = tokens[i];
-          currToken.set_position(currToken.position() - 1);
-          currToken.set_length(currToken.length() + 1);
-          tokens.erase(prevToken);
-        }
-
-        ++i;
+      while (specIdx < spec.size() && spec[specIdx].position() < pos)
+        ++specIdx;
+      if (specIdx < spec.size() && spec[specIdx].position() == pos) {
+        tokens.insert(tokens.end(), spec.begin() + static_cast<ptrdiff_t>(specIdx), spec.end());
+        pos = chunks[i].end;
+        isDone = chunks[i].isLast;
         break;
       }
+
+      pos += tok.length();
+      tokens.push_back(tok);
     }
   }
 
   return tokens;
 }
 
+std::vector<lexer::Token> lexer::tokenize_text_parallel(char const *const text, size_t const textLen, size_t numThreads) {
+  if (numThreads == 0)
+    numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  return detail::tokenize_chunks(text, textLen, std::min(numThreads, textLen / detail::MIN_PARALLEL_CHUNK_LEN));
+}
+
+lexer::RelexResult lexer::relex(
+  std::vector<Token> &tokens,
+  char const *const text,
+  size_t const textLen,
+  size_t const editOffset,
+  size_t const removedLen,
+  size_t const insertedLen
+) {
+  size_t const oldEditEnd = editOffset + removedLen;
+  // moves an old position past the edit to the new text (wraps around when shrinking)
+  uint32_t const shift = static_cast<uint32_t>(insertedLen - removedLen);
+
+  // a token depends on nothing past its end plus the lookahead, the ones which
+  // end far enough before the edit are unchanged (token ends are increasing)
+  size_t const first = static_cast<size_t>(std::partition_point(tokens.begin(), tokens.end(),
+    [&](Token const &tok) { return tok.position() + tok.length() + detail::MAX_LOOKAHEAD <= editOffset; }
+  ) - tokens.begin());
+
+  // `tokenize_text` resumes right where the previous token ended, which is before the edit
+  size_t pos = first == 0 ? 0 : tokens[first - 1].position() + tokens[first - 1].length();
+
+  // first old token whose text and everything after it is untouched, once a new token matches
+  // one of those, lexing from there gives the same tokens as before
+  size_t resync = static_cast<size_t>(std::partition_point(tokens.begin() + static_cast<ptrdiff_t>(first), tokens.end(),
+    [&](Token const &tok) { return tok.position() < oldEditEnd; }
+  ) - tokens.begin());
+
+  std::vector<Token> relexed{};
+  bool isSynced = false;
+
+  while (pos < textLen) {
+    Token const tok = detail::extract_token(text, textLen, pos);
+    if (tok.type() == TokenType::NIL)
+      break;
+
+    pos += tok.length();
+
+    while (resync < tokens.size() && tokens[resync].position() + shift < tok.position())
+      ++resync;
+    if (resync < tokens.size()) {
+      Token const &old = tokens[resync];
+      if (old.type() == tok.type() && old.position() + shift == tok.position() && old.length() == tok.length()) {
+        isSynced = true;
+        break;
+      }
+    }
+
+    relexed.push_back(tok);
+  }
+
+  // without a match, everything from `first` on was relexed
+  if (!isSynced)
+    resync = tokens.size();
+
+  for (size_t i = resync; i < tokens.size(); ++i)
+    tokens[i].set_position(tokens[i].position() + shift);
+
+  // splice so the suffix is moved at most once
+  size_t const numRemoved = resync - first;
+  auto const numCommon = static_cast<ptrdiff_t>(std::min(numRemoved, relexed.size()));
+  auto const replaced = tokens.begin() + static_cast<ptrdiff_t>(first);
+  auto const suffix = tokens.begin() + static_cast<ptrdiff_t>(resync);
+  std::copy_n(relexed.begin(), numCommon, replaced);
+  if (relexed.size() > numRemoved)
+    tokens.insert(suffix, relexed.begin() + numCommon, relexed.end());
+  else
+    tokens.erase(replaced + numCommon, suffix);
+
+  return { first, numRemoved, relexed.size() };
+}
+
+void lexer::TokenStream::feed(char const *const chunk, size_t const chunkLen) {
+  // drop everything which was already tokenized before growing the buffer
+  if (m_consumed > 0) {
+    m_buffer.erase(0, m_consumed);
+    m_bufferStart += m_consumed;
+    m_consumed = 0;
+  }
+
+  m_buffer.append(chunk, chunkLen);
+}
+
+void lexer::TokenStream::finish() noexcept {
+  m_finished = true;
+}
+
+bool lexer::TokenStream::next(Token &out) {
+  if (m_done)
+    return false;
+
+  size_t pos = m_consumed;
+  Token tok = detail::extract_token(m_buffer.data(), m_buffer.size(), pos);
+
+  size_t const tokEnd = pos + tok.length();
+  bool const isComplete = m_finished || tokEnd + detail::MAX_LOOKAHEAD <= m_buffer.size();
+
+  if (!isComplete)
+    return false;
+
+  if (tok.type() == TokenType::NIL) {
+    // either end of input or a character we can't tokenize, `tokenize_text` stops here as well
+    m_done = true;
+    m_consumed = m_buffer.size();
+    return false;
+  }
+
+  m_consumed = tokEnd;
+
+  tok.set_position(static_cast<uint32_t>(m_bufferStart + pos));
+  out = tok;
+  return true;
+}
+
+bool lexer::TokenStream::done() const noexcept {
+  return m_done;
+}
+
+std::string_view lexer::TokenStream::text_of(Token const &tok) const noexcept {
+  if (tok.position() < m_bufferStart)
+    return {};
+
+  size_t const localPos = tok.position() - m_bufferStart;
+  if (localPos + tok.length() > m_buffer.size())
+    return {};
+
+  return std::string_view(m_buffer).substr(localPos, tok.length());
+}
+
 lexer::Token lexer::detail::extract_token(
   char const *const text,
   size_t const textLen,
   size_t &pos
 ) {
   // advance `pos` to beginning of next token:
-  for (; pos < textLen && util::is_non_newline_whitespace(text[pos]); ++pos);
+  pos += scan::count_whitespace(text + pos, textLen - pos);
+
+  if (pos >= textLen)
+    return { lexer::TokenType::NIL, static_cast<uint32_t>(pos), 0 };
 
   char const *const firstChar = text + pos;
 
@@ -120,6 +531,25 @@ lexer::Token lexer::detail::extract_token(
   size_t const tokLen = lexer::detail::determine_token_len(
     firstChar, broadTokType, textLen - pos);
 
+  if (broadTokType == lexer::detail::BroadTokenType::KEYWORD_OR_IDENTIFIER) {
+    size_t const literalLen = lexer::detail::determine_prefixed_literal_len(
+      firstChar, tokLen, textLen - pos);
+
+    if (literalLen > 0) {
+      //  u8"abc"
+      //  ^ ^
+      //  | |
+      //  | quote
+      //  firstChar
+      char const quote = *(firstChar + tokLen);
+      return {
+        quote == '"' ? lexer::TokenType::LITERAL_STR : lexer::TokenType::LITERAL_CHAR,
+        static_cast<uint32_t>(pos),
+        static_cast<uint32_t>(literalLen),
+      };
+    }
+  }
+
   lexer::TokenType const tokType = lexer::detail::determine_token_type(
     firstChar, broadTokType, tokLen);
 
@@ -130,31 +560,81 @@ lexer::Token lexer::detail::extract_token(
   };
 }
 
-lexer::detail::BroadTokenType lexer::detail::determine_token_broad_type(char const firstChar) {
+namespace {
   using lexer::detail::BroadTokenType;
 
-  switch (firstChar) {
-    case '\n': return BroadTokenType::NEWLINE;
-    case '#':  return BroadTokenType::PREPRO;
-    case '.':  return BroadTokenType::OPER_OR_LITERAL_OR_SPECIAL;
-    case '/':  return BroadTokenType::OPER_OR_COMMENT;
-    default:   break;
-  }
+  // maps every possible first character of a token to its broad type,
+  // so classification is a single load instead of a chain of comparisons
+  struct BroadTypeTable {
+    BroadTokenType types[256];
+
+    constexpr BroadTypeTable() : types{} {
+      auto const set = [this](char const *const chars, BroadTokenType const type) {
+        for (char const *c = chars; *c != '\0'; ++c)
+          types[static_cast<uint8_t>(*c)] = type;
+      };
+
+      set("!%&*+-<=>^|~", BroadTokenType::OPERATOR);
+      set("(),:;?[\\]{}", BroadTokenType::SPECIAL);
+      set("\"'0123456789", BroadTokenType::LITERAL);
+      set("_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", BroadTokenType::KEYWORD_OR_IDENTIFIER);
+      set("\r\n", BroadTokenType::NEWLINE);
+      set("#", BroadTokenType::PREPRO);
+      set(".", BroadTokenType::OPER_OR_LITERAL_OR_SPECIAL);
+      set("/", BroadTokenType::OPER_OR_COMMENT);
+    }
+  };
 
-  if (firstChar == '_' || util::is_alphabetic(firstChar)) {
-    return BroadTokenType::KEYWORD_OR_IDENTIFIER;
-  }
-  if (firstChar == '"' || firstChar == '\'' || util::is_digit(firstChar)) {
-    return BroadTokenType::LITERAL;
-  }
-  if (std::strchr("!%&*+-<=>^|~", firstChar)) {
-    return BroadTokenType::OPERATOR;
-  }
-  if (std::strchr("(),:;?[\\]{}", firstChar)) {
-    return BroadTokenType::SPECIAL;
+  constexpr BroadTypeTable s_broadTypes{};
+}
+
+lexer::detail::BroadTokenType lexer::detail::determine_token_broad_type(char const firstChar) {
+  return s_broadTypes.types[static_cast<uint8_t>(firstChar)];
+}
+
+// Returns the position of the first occurrence of `first` immediately followed by `second`
+// at or after `startPos`, or `len` if there is none.
+static
+size_t find_char_pair(
+  char const *const str,
+  size_t const len,
+  size_t startPos,
+  char const first,
+  char const second
+) {
+  while (startPos + 1 < len) {
+    startPos += scan::find_char(str + startPos, len - startPos - 1, first);
+    if (startPos + 1 >= len)
+      break;
+    if (str[startPos + 1] == second)
+      return startPos;
+    ++startPos;
   }
+  return len;
+}
+
+// Returns the position of the first line break at or after `startPos` which isn't a line
+// continuation ("\\\n" or "\\\r\n"), or `len` if there is none. As in translation phase 2, only
+// the character right before the break counts, an even run of backslashes still continues the line.
+// The line break of a "\r\n" is reported at the position of its '\r'.
+static
+size_t find_line_end(
+  char const *const str,
+  size_t const len,
+  size_t startPos
+) {
+  while (startPos < len) {
+    size_t const newlinePos = startPos + scan::find_char(str + startPos, len - startPos, '\n');
+    if (newlinePos >= len)
+      return len;
 
-  return BroadTokenType::NIL;
+    size_t const breakPos = newlinePos > startPos && str[newlinePos - 1] == '\r' ? newlinePos - 1 : newlinePos;
+    if (breakPos == startPos || str[breakPos - 1] != '\\')
+      return breakPos;
+
+    startPos = newlinePos + 1;
+  }
+  return len;
 }
 
 static
@@ -183,11 +663,11 @@ keep_going:
     pos < numCharsRemaining && (
       util::is_digit(CURRCHAR) ||
       util::is_alphabetic(CURRCHAR) ||
-      std::strchr("'.", CURRCHAR)
+      CURRCHAR == '\'' || CURRCHAR == '.' || CURRCHAR == '_'
     )
   ) ++pos;
 
-  if (!std::strchr("+-", CURRCHAR))
+  if (pos >= numCharsRemaining || (CURRCHAR != '+' && CURRCHAR != '-'))
     return pos;
 
   // might be scientific notation...
@@ -207,6 +687,114 @@ keep_going:
   #undef CURRCHAR
 }
 
+// user-defined literal suffixes, e.g. "abc"s or 'x'_c
+static
+size_t find_literal_suffix_len(
+  char const *const firstCharAfterLiteral,
+  size_t const numCharsRemaining
+) {
+  if (numCharsRemaining == 0)
+    return 0;
+
+  char const c = *firstCharAfterLiteral;
+  if (c != '_' && !util::is_alphabetic(c))
+    return 0;
+
+  return scan::count_identifier_chars(firstCharAfterLiteral, numCharsRemaining);
+}
+
+// R"delim( ... )delim", no escape sequences apply inside
+static
+size_t find_raw_string_literal_len(
+  char const *const openingQuote,
+  size_t const numCharsRemaining
+) {
+  // the delimiter is at most 16 characters and may not contain
+  // parentheses, backslashes or whitespace
+  size_t const maxDelimLen = 16;
+
+  size_t delimLen = 0;
+  while (true) {
+    size_t const charPos = 1 + delimLen;
+    if (charPos >= numCharsRemaining || delimLen > maxDelimLen)
+      return 0;
+
+    char const c = *(openingQuote + charPos);
+    if (c == '(')
+      break;
+    if (c == ')' || c == '\\' || c == '"' || c == ' ' || c == '\t' || c == '\n')
+      return 0;
+
+    ++delimLen;
+  }
+
+  std::string_view const delim(openingQuote + 1, delimLen);
+
+  // look for )delim"
+  size_t closingParenPos = 2 + delimLen;
+  while (closingParenPos < numCharsRemaining) {
+    closingParenPos += scan::find_char(
+      openingQuote + closingParenPos, numCharsRemaining - closingParenPos, ')');
+
+    size_t const closingQuotePos = closingParenPos + 1 + delimLen;
+    if (
+      closingQuotePos < numCharsRemaining &&
+      std::string_view(openingQuote + closingParenPos + 1, delimLen) == delim &&
+      *(openingQuote + closingQuotePos) == '"'
+    ) {
+      return closingQuotePos + 1 + find_literal_suffix_len(
+        openingQuote + closingQuotePos + 1, numCharsRemaining - closingQuotePos - 1);
+    }
+
+    ++closingParenPos;
+  }
+
+  // unclosed, we don't care
+  return numCharsRemaining;
+}
+
+size_t lexer::detail::determine_prefixed_literal_len(
+  char const *const firstChar,
+  size_t const prefixLen,
+  size_t const numCharsRemaining
+) {
+  if (prefixLen >= numCharsRemaining || prefixLen > 3)
+    return 0;
+
+  char const quote = *(firstChar + prefixLen);
+  if (quote != '"' && quote != '\'')
+    return 0;
+
+  std::string_view const prefix(firstChar, prefixLen);
+
+  bool const isRaw = prefix.back() == 'R';
+  std::string_view const encoding = isRaw ? prefix.substr(0, prefixLen - 1) : prefix;
+
+  bool const isEncoding =
+    encoding.empty() ||
+    encoding == "L" ||
+    encoding == "u" ||
+    encoding == "U" ||
+    encoding == "u8";
+
+  if (!isEncoding || (encoding.empty() && !isRaw))
+    return 0;
+
+  if (isRaw) {
+    if (quote != '"')
+      return 0;
+
+    size_t const rawLen = find_raw_string_literal_len(
+      firstChar + prefixLen, numCharsRemaining - prefixLen);
+    return rawLen == 0 ? 0 : prefixLen + rawLen;
+  }
+
+  return prefixLen + lexer::detail::determine_token_len(
+    firstChar + prefixLen,
+    lexer::detail::BroadTokenType::LITERAL,
+    numCharsRemaining - prefixLen);
+}
+
 size_t lexer::detail::determine_token_len(
   char const *const firstChar,
   lexer::detail::BroadTokenType const broadTokType,
@@ -219,6 +807,9 @@ size_t lexer::detail::determine_token_len(
 
   switch (broadTokType) {
     case BroadTokenType::NEWLINE:
+      // "\r\n" is a single newline
+      return (*firstChar == '\r' && numCharsRemaining > 1 && *(firstChar + 1) == '\n') ? 2 : 1;
+
     case BroadTokenType::SPECIAL:
       return 1;
 
@@ -232,18 +823,25 @@ size_t lexer::detail::determine_token_len(
           return 2; // ##
       }
 
-      size_t const firstNewlinePos = util::find_unescaped(firstChar, '\n', '\\');
-      char const *const firstOpeningMultiLineComment = std::strstr(firstChar, "/*");
-      size_t const firstOpeningMultiLineCommentPos =
-        firstOpeningMultiLineComment == nullptr
-          ? size_t(UINT32_MAX)
-          : size_t(firstOpeningMultiLineComment - firstChar);
+      // the directive extends to the first unescaped newline which isn't inside
+      // a multi-line comment, e.g.
+      // #define N 10 /*
+      //   comment
+      // */
+      size_t searchPos = 1;
+      while (true) {
+        size_t const newlinePos = find_line_end(firstChar, numCharsRemaining, searchPos);
+
+        size_t const commentOpenPos = find_char_pair(firstChar, newlinePos, searchPos, '/', '*');
+        if (commentOpenPos == newlinePos)
+          return newlinePos;
+
+        size_t const commentClosePos = find_char_pair(
+          firstChar, numCharsRemaining, commentOpenPos + 2, '*', '/');
+        if (commentClosePos == numCharsRemaining)
+          return numCharsRemaining;
 
-      if (firstOpeningMultiLineCommentPos < firstNewlinePos) {
-        char const *const commentClose = std::strstr(firstChar, "*/");
-        return size_t(commentClose - firstChar) + 2ull;
-      } else {
-        return firstNewlinePos;
+        searchPos = commentClosePos + 2;
       }
     }
 
@@ -262,13 +860,13 @@ size_t lexer::detail::determine_token_len(
 
       char const *lastChar = firstChar + 1;
 
+      char const *const endChar = firstChar + numCharsRemaining;
+
       // advance `lastChar` to first non-digit character
-      while (
-        static_cast<size_t>(lastChar - firstChar) <= numCharsRemaining &&
-        util::is_digit(*lastChar)
-      ) ++lastChar;
+      while (lastChar < endChar && util::is_digit(*lastChar))
+        ++lastChar;
 
-      if (*lastChar == 'f' || *lastChar == 'F')
+      if (lastChar < endChar && (*lastChar == 'f' || *lastChar == 'F'))
         return size_t(lastChar - firstChar) + 1ull;
       else
         return size_t(lastChar - firstChar);
@@ -282,42 +880,30 @@ size_t lexer::detail::determine_token_len(
       switch (secondChar) {
         case '=':
           return 2;
-        case '/': {
-          char const *firstUnescapedNewline = firstChar + 2; // start at 3rd character
-          while (true) {
-            firstUnescapedNewline = std::strchr(firstUnescapedNewline, '\n');
-            if (firstUnescapedNewline == nullptr)
-              // couldn't find a newline, comment extends to end of file
-              return numCharsRemaining;
-            else if (*(firstUnescapedNewline - 1) != '\\')
-              // found an unescaped newline
-              return size_t(firstUnescapedNewline - firstChar);
-            else
-              // found a newline, but it's escaped
-              ++firstUnescapedNewline;
-          }
-        }
+        case '/':
+          // extends to the end of the line, or of the file
+          return find_line_end(firstChar, numCharsRemaining, 2);
         case '*': {
-          std::string_view const content(firstChar);
-          size_t const endSequencePos = content.find("*/");
-          if (endSequencePos == std::string_view::npos)
-            return numCharsRemaining;
-          else
-            return endSequencePos + 2;
+          // look for the '/' of "*/", they are much rarer than '*' in
+          // banner-style comments. starting at the 4th character ensures
+          // the opening "/*" can't double as the closing "*/"
+          size_t slashPos = 3;
+          while (slashPos < numCharsRemaining) {
+            slashPos += scan::find_char(
+              firstChar + slashPos, numCharsRemaining - slashPos, '/');
+            if (slashPos < numCharsRemaining && *(firstChar + slashPos - 1) == '*')
+              return slashPos + 1;
+            ++slashPos;
+          }
+          return numCharsRemaining;
         }
         default:
           return 1;
       }
     }
 
-    case BroadTokenType::KEYWORD_OR_IDENTIFIER: {
-      for (size_t pos = 1; pos <= numCharsRemaining; ++pos) {
-        char const c = *(firstChar + pos);
-        if (!util::is_alphabetic(c) && !util::is_digit(c) && c != '_')
-          return pos;
-      }
-      return numCharsRemaining;
-    }
+    case BroadTokenType::KEYWORD_OR_IDENTIFIER:
+      return 1 + scan::count_identifier_chars(firstChar + 1, numCharsRemaining - 1);
 
     case BroadTokenType::OPERATOR: {
       if (numCharsRemaining == 1 || *firstChar == '~') {
@@ -390,13 +976,14 @@ size_t lexer::detail::determine_token_len(
       } else if (*firstChar == '\'' || *firstChar == '"') {
         // string or character literal
         size_t const closingCharPos = util::find_unescaped(
-          firstChar, *firstChar, '\\', 1
+          firstChar, numCharsRemaining, *firstChar, '\\', 1
         );
         if (closingCharPos == std::string::npos)
           // string/character literal is unclosed, we don't care
           return numCharsRemaining;
         else
-          return closingCharPos + 1;
+          return closingCharPos + 1 + find_literal_suffix_len(
+            firstChar + closingCharPos + 1, numCharsRemaining - closingCharPos - 1);
       } else {
         return find_numeric_literal_len(firstChar, numCharsRemaining);
       }
@@ -407,15 +994,15 @@ size_t lexer::detail::determine_token_len(
   }
 }
 
-lexer::TokenType lexer::detail::determine_token_type(
-  char const *const firstChar,
-  lexer::detail::BroadTokenType const broadTokType,
-  size_t const len
-) {
-  using lexer::detail::BroadTokenType;
+namespace {
   using lexer::TokenType;
 
-  static std::unordered_map<std::string, TokenType> const s_preproDirectives {
+  struct KeywordEntry {
+    std::string_view spelling;
+    TokenType type;
+  };
+
+  constexpr KeywordEntry s_preproDirectives[] {
     { "include", TokenType::PREPRO_DIR_INCLUDE },
     { "define", TokenType::PREPRO_DIR_DEFINE },
     { "undef", TokenType::PREPRO_DIR_UNDEF },
@@ -428,7 +1015,8 @@ lexer::TokenType lexer::detail::determine_token_type(
     { "error", TokenType::PREPRO_DIR_ERROR },
     { "pragma", TokenType::PREPRO_DIR_PRAGMA },
   };
-  static std::unordered_map<std::string, TokenType> const s_keywordsOperatorsSpecialSymbols {
+
+  constexpr KeywordEntry s_keywords[] {
     { "auto", TokenType::KEYWORD_AUTO },
     { "break", TokenType::KEYWORD_BREAK },
     { "case", TokenType::KEYWORD_CASE },
@@ -473,52 +1061,146 @@ lexer::TokenType lexer::detail::determine_token_type(
     { "_Noreturn", TokenType::KEYWORD_NORETURN },
     { "_Static_assert", TokenType::KEYWORD_STATICASSERT },
     { "_Thread_local", TokenType::KEYWORD_THREADLOCAL },
-    { "+", TokenType::OPER_PLUS },
-    { "++", TokenType::OPER_PLUSPLUS },
-    { "-", TokenType::OPER_MINUS },
-    { "--", TokenType::OPER_MINUSMINUS },
-    { "%", TokenType::OPER_MOD },
-    { "=", TokenType::OPER_ASSIGN },
-    { "+=", TokenType::OPER_ASSIGN_ADD },
-    { "-=", TokenType::OPER_ASSIGN_SUB },
-    { "*=", TokenType::OPER_ASSIGN_MULT },
-    { "%=", TokenType::OPER_ASSIGN_MOD },
-    { "==", TokenType::OPER_REL_EQ },
-    { "!=", TokenType::OPER_REL_NOTEQ },
-    { "<", TokenType::OPER_REL_LESSTHAN },
-    { "<=", TokenType::OPER_REL_LESSTHANEQ },
-    { ">", TokenType::OPER_REL_GREATERTHAN },
-    { ">=", TokenType::OPER_REL_GREATERTHANEQ },
-    { "&&", TokenType::OPER_LOGIC_AND },
-    { "||", TokenType::OPER_LOGIC_OR },
-    { "!", TokenType::OPER_LOGIC_NOT },
-    { "~", TokenType::OPER_BITWISE_NOT },
-    { "&=", TokenType::OPER_ASSIGN_BITAND },
-    { "|", TokenType::OPER_BITWISE_OR },
-    { "|=", TokenType::OPER_ASSIGN_BITOR },
-    { "^", TokenType::OPER_BITWISE_XOR },
-    { "^=", TokenType::OPER_ASSIGN_BITXOR },
-    { "<<", TokenType::OPER_BITWISE_SHIFTLEFT },
-    { "<<=", TokenType::OPER_ASSIGN_BITSHIFTLEFT },
-    { ">>", TokenType::OPER_BITWISE_SHIFTRIGHT },
-    { ">>=", TokenType::OPER_ASSIGN_BITSHIFTRIGHT },
-    { "->", TokenType::OPER_ARROW },
-    { "&", TokenType::OPER_AMPERSAND },
-    { "*", TokenType::OPER_STAR },
-    { "(", TokenType::SPECIAL_PAREN_OPEN },
-    { ")", TokenType::SPECIAL_PAREN_CLOSE },
-    { "{", TokenType::SPECIAL_BRACE_OPEN },
-    { "}", TokenType::SPECIAL_BRACE_CLOSE },
-    { "[", TokenType::SPECIAL_BRACKET_OPEN },
-    { "]", TokenType::SPECIAL_BRACKET_CLOSE },
-    { "?", TokenType::SPECIAL_QUESTION },
-    { ":", TokenType::SPECIAL_COLON },
-    { "...", TokenType::SPECIAL_ELLIPSES },
-    { ",", TokenType::SPECIAL_COMMA },
-    { ";", TokenType::SPECIAL_SEMICOLON },
-    { "\\", TokenType::SPECIAL_LINE_CONT },
   };
 
+  constexpr uint32_t keyword_hash(std::string_view const str, uint32_t const seed) noexcept {
+    // only looks at the length and 3 characters, which is enough to tell
+    // all of the keywords apart and keeps the hash cheap for long identifiers
+    uint32_t hash = seed ^ (static_cast<uint32_t>(str.length()) * 0x9E3779B1u);
+    hash = (hash ^ static_cast<uint8_t>(str.front())) * 0x01000193u;
+    hash = (hash ^ static_cast<uint8_t>(str[str.length() / 2])) * 0x01000193u;
+    hash = (hash ^ static_cast<uint8_t>(str.back())) * 0x01000193u;
+    return hash ^ (hash >> 15);
+  }
+
+  // Collision-free hash table over a fixed set of keywords, with the
+  // seed searched for at compile time. A lookup is one hash, one load
+  // and at most one string comparison.
+  template <size_t NumEntries, size_t TableSize>
+  struct PerfectHashTable {
+    static_assert((TableSize & (TableSize - 1)) == 0, "TableSize must be a power of 2");
+    static_assert(NumEntries < UINT8_MAX);
+
+    KeywordEntry const *entries;
+    uint32_t seed = 0;
+    uint8_t slots[TableSize] {}; // 1-based index into `entries`, 0 means empty
+
+    consteval PerfectHashTable(KeywordEntry const (&keywords)[NumEntries]) : entries{keywords} {
+      for (seed = 1; seed < 100'000; ++seed) {
+        if (try_fill())
+          return;
+      }
+      throw "no perfect hash seed found, increase TableSize";
+    }
+
+    constexpr bool try_fill() noexcept {
+      for (auto &slot : slots)
+        slot = 0;
+
+      for (size_t i = 0; i < NumEntries; ++i) {
+        uint8_t &slot = slots[keyword_hash(entries[i].spelling, seed) & (TableSize - 1)];
+        if (slot != 0)
+          return false;
+        slot = static_cast<uint8_t>(i + 1);
+      }
+
+      return true;
+    }
+
+    constexpr TokenType find(std::string_view const str, TokenType const notFound) const noexcept {
+      if (str.empty())
+        return notFound;
+
+      uint8_t const slot = slots[keyword_hash(str, seed) & (TableSize - 1)];
+      if (slot == 0)
+        return notFound;
+
+      KeywordEntry const &entry = entries[slot - 1];
+      return entry.spelling == str ? entry.type : notFound;
+    }
+  };
+
+  constexpr PerfectHashTable<util::lengthof(s_preproDirectives), 32> s_preproDirectivesTable(s_preproDirectives);
+  constexpr PerfectHashTable<util::lengthof(s_keywords), 256> s_keywordsTable(s_keywords);
+
+  static_assert(s_keywordsTable.find("_Static_assert", TokenType::IDENTIFIER) == TokenType::KEYWORD_STATICASSERT);
+  static_assert(s_keywordsTable.find("Static_assert", TokenType::IDENTIFIER) == TokenType::IDENTIFIER);
+  static_assert(s_preproDirectivesTable.find("ifndef", TokenType::NIL) == TokenType::PREPRO_DIR_IFNDEF);
+
+  TokenType determine_operator_type(char const *const firstChar, size_t const len) noexcept {
+    char const secondChar = len > 1 ? *(firstChar + 1) : '\0';
+
+    switch (*firstChar) {
+      case '+':
+        if (secondChar == '+') return TokenType::OPER_PLUSPLUS;
+        if (secondChar == '=') return TokenType::OPER_ASSIGN_ADD;
+        return TokenType::OPER_PLUS;
+      case '-':
+        if (secondChar == '-') return TokenType::OPER_MINUSMINUS;
+        if (secondChar == '=') return TokenType::OPER_ASSIGN_SUB;
+        if (secondChar == '>') return TokenType::OPER_ARROW;
+        return TokenType::OPER_MINUS;
+      case '*':
+        return secondChar == '=' ? TokenType::OPER_ASSIGN_MULT : TokenType::OPER_STAR;
+      case '%':
+        return secondChar == '=' ? TokenType::OPER_ASSIGN_MOD : TokenType::OPER_MOD;
+      case '=':
+        return secondChar == '=' ? TokenType::OPER_REL_EQ : TokenType::OPER_ASSIGN;
+      case '!':
+        return secondChar == '=' ? TokenType::OPER_REL_NOTEQ : TokenType::OPER_LOGIC_NOT;
+      case '^':
+        return secondChar == '=' ? TokenType::OPER_ASSIGN_BITXOR : TokenType::OPER_BITWISE_XOR;
+      case '~':
+        return TokenType::OPER_BITWISE_NOT;
+      case '<':
+        if (len == 3) return TokenType::OPER_ASSIGN_BITSHIFTLEFT;
+        if (secondChar == '<') return TokenType::OPER_BITWISE_SHIFTLEFT;
+        if (secondChar == '=') return TokenType::OPER_REL_LESSTHANEQ;
+        return TokenType::OPER_REL_LESSTHAN;
+      case '>':
+        if (len == 3) return TokenType::OPER_ASSIGN_BITSHIFTRIGHT;
+        if (secondChar == '>') return TokenType::OPER_BITWISE_SHIFTRIGHT;
+        if (secondChar == '=') return TokenType::OPER_REL_GREATERTHANEQ;
+        return TokenType::OPER_REL_GREATERTHAN;
+      case '&':
+        if (secondChar == '&') return TokenType::OPER_LOGIC_AND;
+        if (secondChar == '=') return TokenType::OPER_ASSIGN_BITAND;
+        return TokenType::OPER_AMPERSAND;
+      case '|':
+        if (secondChar == '|') return TokenType::OPER_LOGIC_OR;
+        if (secondChar == '=') return TokenType::OPER_ASSIGN_BITOR;
+        return TokenType::OPER_BITWISE_OR;
+      default:
+        return TokenType::NIL;
+    }
+  }
+
+  TokenType determine_special_type(char const firstChar) noexcept {
+    switch (firstChar) {
+      case '(':  return TokenType::SPECIAL_PAREN_OPEN;
+      case ')':  return TokenType::SPECIAL_PAREN_CLOSE;
+      case '{':  return TokenType::SPECIAL_BRACE_OPEN;
+      case '}':  return TokenType::SPECIAL_BRACE_CLOSE;
+      case '[':  return TokenType::SPECIAL_BRACKET_OPEN;
+      case ']':  return TokenType::SPECIAL_BRACKET_CLOSE;
+      case '?':  return TokenType::SPECIAL_QUESTION;
+      case ':':  return TokenType::SPECIAL_COLON;
+      case ',':  return TokenType::SPECIAL_COMMA;
+      case ';':  return TokenType::SPECIAL_SEMICOLON;
+      case '\\': return TokenType::SPECIAL_LINE_CONT;
+      default:   return TokenType::NIL;
+    }
+  }
+}
+
+lexer::TokenType lexer::detail::determine_token_type(
+  char const *const firstChar,
+  lexer::detail::BroadTokenType const broadTokType,
+  size_t const len
+) {
+  using lexer::detail::BroadTokenType;
+  using lexer::TokenType;
+
   switch (broadTokType) {
     default:
     case BroadTokenType::NIL:
@@ -530,7 +1212,7 @@ lexer::TokenType lexer::detail::determine_token_type(
     case BroadTokenType::OPER_OR_LITERAL_OR_SPECIAL: {
       if (len == 1)
         return TokenType::OPER_DOT;
-      if (len == 3 && std::strcmp(firstChar, "...") == 0)
+      if (std::string_view(firstChar, len) == "...")
         return TokenType::SPECIAL_ELLIPSES;
       return TokenType::LITERAL_NUM;
     }
@@ -561,7 +1243,7 @@ lexer::TokenType lexer::detail::determine_token_type(
     }
 
     case BroadTokenType::PREPRO: {
-      if (len == 2)
+      if (len == 2 && *(firstChar + 1) == '#')
         return TokenType::PREPRO_OPER_CONCAT;
 
       // directives can have whitespace between the # and the letters:
@@ -569,8 +1251,9 @@ lexer::TokenType lexer::detail::determine_token_type(
       //  ^^^
       //  we must account for this
 
+      char const *const lastChar = firstChar + len;
       char const *firstAlphabeticChar = firstChar + 1;
-      while (!util::is_alphabetic(*firstAlphabeticChar))
+      while (firstAlphabeticChar < lastChar && !util::is_alphabetic(*firstAlphabeticChar))
         ++firstAlphabeticChar;
 
       // #   define
@@ -579,34 +1262,26 @@ lexer::TokenType lexer::detail::determine_token_type(
       // |   firstAlphabeticChar
       // firstChar
 
-      size_t directiveLen = 1;
-      {
-        char const *p = firstAlphabeticChar + 1;
-        while (util::is_alphabetic(*p++))
-          ++directiveLen;
-      }
+      char const *directiveEnd = firstAlphabeticChar;
+      while (directiveEnd < lastChar && util::is_alphabetic(*directiveEnd))
+        ++directiveEnd;
 
-      std::string const directive( // content should be "include", "define", etc.
+      // content should be "include", "define", etc.
+      std::string_view const directive(
         firstAlphabeticChar,
-        directiveLen
+        size_t(directiveEnd - firstAlphabeticChar)
       );
 
-      auto const type = s_preproDirectives.find(directive);
-      if (type == s_preproDirectives.end())
-        return TokenType::NIL;
-      else
-        return type->second;
+      return s_preproDirectivesTable.find(directive, TokenType::NIL);
     }
 
     case BroadTokenType::KEYWORD_OR_IDENTIFIER:
+      return s_keywordsTable.find(std::string_view(firstChar, len), TokenType::IDENTIFIER);
+
     case BroadTokenType::OPERATOR:
-    case BroadTokenType::SPECIAL: {
-      std::string const token(firstChar, len);
-      auto const type = s_keywordsOperatorsSpecialSymbols.find(token);
-      if (type == s_keywordsOperatorsSpecialSymbols.end())
-        return TokenType::IDENTIFIER;
-      else
-        return type->second;
-    }
+      return determine_operator_type(firstChar, len);
+
+    case BroadTokenType::SPECIAL:
+      return determine_special_type(*firstChar);
   }
 }
@@ -2,8 +2,12 @@
 #define CTRUCT_LEXER_HPP
 
 #include <cstdint>
+#include <memory_resource>
 #include <vector>
 #include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
 
 namespace lexer {
 
@@ -171,9 +175,180 @@ namespace lexer {
       uint32_t m_pos, m_len;
   };
 
+  // Structure-of-arrays token storage, 6 bytes per token instead of the 12 of a `Token`.
+  // Passes which only look at types (bracket matching, statement splitting...) touch
+  // just the type array. Lengths are stored in a byte, the few tokens longer than
+  // that (comments, string literals, directives) keep theirs in a side table.
+  class TokenBuffer {
+    public:
+      void push_back(Token const &);
+      void reserve(size_t numTokens);
+      void clear() noexcept;
+
+      size_t size() const noexcept;
+      bool empty() const noexcept;
+
+      TokenType type(size_t idx) const noexcept;
+      uint32_t position(size_t idx) const noexcept;
+      uint32_t length(size_t idx) const;
+      Token operator[](size_t idx) const;
+
+      std::vector<TokenType> const &types() const noexcept;
+      std::vector<uint32_t> const &positions() const noexcept;
+
+      std::vector<Token> to_vector() const;
+
+    private:
+      // marks a length which lives in `m_longLengths`
+      static constexpr uint8_t s_longLength = UINT8_MAX;
+
+      std::vector<TokenType> m_types{};
+      std::vector<uint32_t> m_positions{};
+      std::vector<uint8_t> m_lengths{};
+      // (token index, length), sorted by index since tokens are only ever appended
+      std::vector<std::pair<uint32_t, uint32_t>> m_longLengths{};
+  };
+
+  // Structure of the preprocessor directives of a text: which conditional directives pair up, what
+  // is #defined and #included where. Filled while lexing (see the `tokenize_text` taking one), so
+  // finding or skipping a conditional region needs no rescan of the tokens. Positions are byte offsets.
+  class PreproIndex {
+    public:
+      static constexpr uint32_t NONE = UINT32_MAX;
+
+      // #if/#ifdef/#ifndef up to its #endif
+      struct Conditional {
+        uint32_t begin;                 // of the opening directive
+        uint32_t end;                   // past the #endif, the end of the text if it's missing
+        uint32_t parent;                // index of the enclosing conditional, NONE at the top level
+        std::vector<uint32_t> branches; // positions of its #elif and #else directives, then of its #endif
+      };
+
+      struct Define {
+        std::string name;
+        uint32_t begin;
+        uint32_t end; // continuation lines included
+      };
+
+      struct Include {
+        std::string path; // as spelled, "x.h" or <x.h>
+        uint32_t begin;
+        uint32_t end;
+      };
+
+      // Records `tok` if it's a directive, `text` being what it was lexed from. Tokens come in order.
+      void add(Token const &tok, char const *text);
+
+      // Ends the conditionals without an #endif at `textLen`.
+      void finish(size_t textLen);
+
+      // every directive token, in order
+      std::vector<Token> const &directives() const noexcept;
+      // in order of their opening directives, so an enclosing one comes before those inside it
+      std::vector<Conditional> const &conditionals() const noexcept;
+      std::vector<Define> const &defines() const noexcept;
+      std::vector<Include> const &includes() const noexcept;
+
+      // The innermost conditional whose [begin, end) contains `pos`, or NONE.
+      uint32_t conditional_at(uint32_t pos) const;
+
+      // Where the branch of conditional `idx` containing `pos` ends: at the next of its #elif, #else
+      // or #endif (the end of the text if it's missing).
+      uint32_t branch_end(uint32_t idx, uint32_t pos) const;
+
+    private:
+      std::vector<Token> m_directives{};
+      std::vector<Conditional> m_conditionals{};
+      std::vector<Define> m_defines{};
+      std::vector<Include> m_includes{};
+      std::vector<uint32_t> m_open{}; // conditionals whose #endif wasn't seen yet, innermost last
+  };
+
   std::vector<Token> tokenize_text(char const *text, size_t textLen);
 
+  // Same tokens as above, `prepro` is filled in the same pass.
+  std::vector<Token> tokenize_text(char const *text, size_t textLen, PreproIndex &prepro);
+
+  // Same tokens as above, appended to `out`.
+  void tokenize_text(char const *text, size_t textLen, TokenBuffer &out);
+
+  // Same tokens as above, allocated from `memory` (e.g. a per-file util::Arena).
+  std::pmr::vector<Token> tokenize_text(char const *text, size_t textLen, std::pmr::memory_resource &memory);
+
+  // Same tokens as `tokenize_text`, with the text split into chunks lexed on up to `numThreads` threads
+  // (0 means one per hardware thread). Every chunk starts on a line and is lexed as if that line didn't
+  // start inside a comment or literal, then stitched to the tokens before it: lexing goes on from where
+  // those end until a token coincides with one of the chunk's (from the same position, lexing gives the
+  // same tokens), so a mispredicted chunk is only re-lexed up to there. Positions are into the whole text
+  // from the start, nothing needs shifting. Texts under two detail::MIN_PARALLEL_CHUNK_LEN are lexed in
+  // one go.
+  std::vector<Token> tokenize_text_parallel(char const *text, size_t textLen, size_t numThreads = 0);
+
+  // What `relex` did: `numRemoved` tokens at index `first` were replaced by `numInserted` new ones,
+  // the tokens after those are the old ones, moved by the length difference of the edit.
+  struct RelexResult {
+    size_t first;
+    size_t numRemoved;
+    size_t numInserted;
+  };
+
+  // Updates `tokens`, the result of `tokenize_text` before an edit, to the tokens of `text`, the text
+  // after it. The edit replaced `removedLen` characters at `editOffset` by `insertedLen` new ones.
+  // Lexing restarts at the last token boundary whose token can't see the edit and stops as soon as
+  // a token matches an old one lying entirely past the edit, the remaining tokens are only moved.
+  // Produces the same tokens as `tokenize_text(text, textLen)`.
+  RelexResult relex(
+    std::vector<Token> &tokens,
+    char const *text,
+    size_t textLen,
+    size_t editOffset,
+    size_t removedLen,
+    size_t insertedLen
+  );
+
+  // Pull-based tokenizer for input which arrives in chunks (e.g. through a pipe).
+  // Tokens may span chunk boundaries (comments, literals, line continuations...),
+  // a token is only handed out once enough input has been seen to know where it ends.
+  // Only the not-yet-tokenized tail of the input is buffered, so memory use is
+  // bounded by the chunk size plus the longest token rather than by the whole input.
+  // Produces the same tokens as `tokenize_text` over the concatenated input.
+  class TokenStream {
+    public:
+      // Appends the next chunk of input. Invalidates views returned by `text_of`.
+      void feed(char const *chunk, size_t chunkLen);
+
+      // Signals that all input has been fed.
+      void finish() noexcept;
+
+      // Returns true and sets `out` if a complete token is available. Returns false
+      // when more input is needed to produce the next token or when `done()`.
+      bool next(Token &out);
+
+      // True once `finish` was called and every token has been handed out.
+      bool done() const noexcept;
+
+      // Returns the text of a token most recently handed out by `next`.
+      std::string_view text_of(Token const &) const noexcept;
+
+    private:
+      std::string m_buffer{};
+      size_t m_bufferStart = 0; // position of m_buffer[0] within the whole input
+      size_t m_consumed = 0;    // number of m_buffer characters already tokenized
+      bool m_finished = false;
+      bool m_done = false;
+  };
+
   namespace detail {
+    // The furthest any token's length depends on characters past its end,
+    // this is the longest raw string delimiter plus its quote and opening paren.
+    inline constexpr size_t MAX_LOOKAHEAD = 20;
+
+    // smallest chunk `tokenize_text_parallel` gives a thread
+    inline constexpr size_t MIN_PARALLEL_CHUNK_LEN = size_t(1) << 20;
+
+    // `tokenize_text_parallel` with `numChunks` chunks (one thread each) whatever the length of the text.
+    std::vector<Token> tokenize_chunks(char const *text, size_t textLen, size_t numChunks);
+
     // A broad categorization of token based exclusively on its first character
     enum class BroadTokenType : uint8_t {
       // nothingness...
@@ -218,6 +393,11 @@ namespace lexer {
 
     TokenType determine_token_type(char const *firstChar, BroadTokenType, size_t tokLen);
 
+    // If the identifier of length `prefixLen` at `firstChar` is an encoding/raw prefix
+    // directly followed by a string or character literal, returns the length of the
+    // whole prefixed literal (prefix and user-defined suffix included), otherwise 0.
+    size_t determine_prefixed_literal_len(char const *firstChar, size_t prefixLen, size_t numRemainingChars);
+
   } // namespace detail
 
 } // namespace lexer
@@ -0,0 +1,163 @@
+#include "node_dump.hpp"
+#include "util.hpp"
+
+static constexpr std::string_view s_magic = "FNOD\x01";
+
+static
+uint64_t zigzag(int64_t const value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static
+int64_t unzigzag(uint64_t const value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+size_t fmtcpp::NodeDumpWriter::StringHash::operator()(std::string_view const str) const noexcept {
+  return std::hash<std::string_view>{}(str);
+}
+
+fmtcpp::NodeDumpWriter::NodeDumpWriter(int const errorCode)
+: m_errorCode{errorCode}
+{}
+
+void fmtcpp::NodeDumpWriter::add(
+  uint32_t const depth,
+  std::string_view const kind,
+  std::string_view const file,
+  uint32_t const line,
+  uint32_t const column,
+  std::string_view const spelling
+) {
+  util::append_varint(m_nodes, depth);
+  util::append_varint(m_nodes, intern(kind));
+  util::append_varint(m_nodes, file.empty() ? 0 : intern(file) + 1);
+  // consecutive nodes are mostly on the same or nearby lines
+  util::append_varint(m_nodes, zigzag(int64_t(line) - m_prevLine));
+  util::append_varint(m_nodes, column);
+  util::append_varint(m_nodes, intern(spelling));
+
+  m_prevLine = line;
+  ++m_numNodes;
+}
+
+std::string fmtcpp::NodeDumpWriter::finish() {
+  std::string dump(s_magic);
+  util::append_varint(dump, zigzag(m_errorCode));
+  util::append_varint(dump, m_stringIds.size());
+  dump += m_strings;
+  util::append_varint(dump, m_numNodes);
+  dump += m_nodes;
+
+  m_strings.clear();
+  m_stringIds.clear();
+  m_nodes.clear();
+  m_numNodes = 0;
+  m_prevLine = 0;
+
+  return dump;
+}
+
+uint64_t fmtcpp::NodeDumpWriter::intern(std::string_view const str) {
+  auto const found = m_stringIds.find(str);
+  if (found != m_stringIds.end())
+    return found->second;
+
+  uint64_t const id = m_stringIds.size();
+  m_stringIds.emplace(std::string(str), id);
+  util::append_varint(m_strings, str.length());
+  m_strings += str;
+  return id;
+}
+
+bool fmtcpp::NodeDumpReader::open(std::string_view const bytes) {
+  *this = NodeDumpReader{};
+  m_bytes = bytes;
+
+  if (!bytes.starts_with(s_magic))
+    return false;
+  m_pos = s_magic.length();
+
+  uint64_t errorCode, numStrings;
+  if (!util::read_varint(bytes, m_pos, errorCode) || !util::read_varint(bytes, m_pos, numStrings))
+    return false;
+  m_errorCode = static_cast<int>(unzigzag(errorCode));
+
+  // every string takes at least its length byte, don't trust a larger count
+  if (numStrings > bytes.length() - m_pos)
+    return false;
+  m_strings.reserve(numStrings);
+
+  for (uint64_t i = 0; i < numStrings; ++i) {
+    uint64_t len;
+    if (!util::read_varint(bytes, m_pos, len) || len > bytes.length() - m_pos)
+      return false;
+    m_strings.push_back(bytes.substr(m_pos, len));
+    m_pos += len;
+  }
+
+  return util::read_varint(bytes, m_pos, m_numNodes);
+}
+
+int fmtcpp::NodeDumpReader::error_code() const noexcept { return m_errorCode; }
+uint64_t fmtcpp::NodeDumpReader::num_nodes() const noexcept { return m_numNodes; }
+bool fmtcpp::NodeDumpReader::is_corrupt() const noexcept { return m_isCorrupt; }
+
+bool fmtcpp::NodeDumpReader::next(DumpedNode &out) {
+  if (m_isCorrupt || m_numRead == m_numNodes)
+    return false;
+
+  uint64_t fields[6];
+  for (auto &field : fields) {
+    if (!util::read_varint(m_bytes, m_pos, field)) {
+      m_isCorrupt = true;
+      return false;
+    }
+  }
+
+  auto const [depth, kind, file, lineDelta, column, spelling] = fields;
+  if (kind >= m_strings.size() || file > m_strings.size() || spelling >= m_strings.size()) {
+    m_isCorrupt = true;
+    return false;
+  }
+
+  m_prevLine += unzigzag(lineDelta);
+
+  out.depth = static_cast<uint32_t>(depth);
+  out.kind = m_strings[kind];
+  out.file = file == 0 ? std::string_view{} : m_strings[file - 1];
+  out.line = static_cast<uint32_t>(m_prevLine);
+  out.column = static_cast<uint32_t>(column);
+  out.spelling = m_strings[spelling];
+
+  ++m_numRead;
+  return true;
+}
+
+bool fmtcpp::write_dump_as_text(std::string_view const bytes, std::ostream &os) {
+  NodeDumpReader reader{};
+  if (!reader.open(bytes))
+    return false;
+
+  os << "clang_parseTranslationUnit2 CXErrorCode = " << reader.error_code() << '\n';
+
+  std::string line{};
+  for (DumpedNode node{}; reader.next(node);) {
+    line.clear();
+    if (!node.file.empty()) {
+      line += node.file;
+      line += ':';
+      line += std::to_string(node.line);
+      line += ',';
+      line += std::to_string(node.column);
+      line += "   ";
+    }
+    line += node.kind;
+    line += "   ";
+    line += node.spelling;
+    line += '\n';
+    os.write(line.data(), static_cast<std::streamsize>(line.length()));
+  }
+
+  return !reader.is_corrupt();
+}
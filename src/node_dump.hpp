@@ -0,0 +1,97 @@
+// compact binary form of the output of fmtcpp::print_nodes
+
+#ifndef FMTCPP_NODE_DUMP_HPP
+#define FMTCPP_NODE_DUMP_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fmtcpp {
+
+// Layout, all integers are LEB128 varints (util::append_varint):
+//   "FNOD" 0x01
+//   parse error code
+//   number of strings, each as length + bytes
+//   number of nodes, each as: depth, kind string, file string + 1 (0: none),
+//                             line - previous node's line (zigzag), column, spelling string
+// Every distinct string (file name, cursor kind, spelling) is stored once, nodes refer to
+// them by index, so a node usually takes around 7 bytes instead of a line of text.
+class NodeDumpWriter {
+  public:
+    explicit NodeDumpWriter(int errorCode);
+
+    // `file` empty for nodes without a location.
+    void add(
+      uint32_t depth,
+      std::string_view kind,
+      std::string_view file,
+      uint32_t line,
+      uint32_t column,
+      std::string_view spelling
+    );
+
+    // Returns the whole dump, the writer is empty afterwards.
+    std::string finish();
+
+  private:
+    uint64_t intern(std::string_view);
+
+    // lets `intern` hash a string_view without building a std::string
+    struct StringHash {
+      using is_transparent = void;
+      size_t operator()(std::string_view str) const noexcept;
+    };
+
+    int m_errorCode;
+    std::string m_strings{};
+    std::unordered_map<std::string, uint64_t, StringHash, std::equal_to<>> m_stringIds{};
+    std::string m_nodes{};
+    uint64_t m_numNodes = 0;
+    int64_t m_prevLine = 0;
+};
+
+struct DumpedNode {
+  uint32_t depth;
+  std::string_view kind;
+  std::string_view file; // empty for nodes without a location
+  uint32_t line;
+  uint32_t column;
+  std::string_view spelling;
+};
+
+// Reads a dump in place (e.g. from a util::MappedFile), the views it hands out point into it.
+class NodeDumpReader {
+  public:
+    // False if `bytes` doesn't start with a valid header and string table.
+    bool open(std::string_view bytes);
+
+    int error_code() const noexcept;
+    uint64_t num_nodes() const noexcept;
+
+    // Returns false once all nodes were read, or if the dump is corrupt (see `is_corrupt`).
+    bool next(DumpedNode &);
+
+    bool is_corrupt() const noexcept;
+
+  private:
+    std::string_view m_bytes{};
+    size_t m_pos = 0;
+    std::vector<std::string_view> m_strings{};
+    int m_errorCode = 0;
+    uint64_t m_numNodes = 0;
+    uint64_t m_numRead = 0;
+    int64_t m_prevLine = 0;
+    bool m_isCorrupt = false;
+};
+
+// Writes exactly what `print_nodes` wrote when the dump was taken. False if `bytes` isn't
+// a valid dump, `os` may have received part of the text then.
+bool write_dump_as_text(std::string_view bytes, std::ostream &os);
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_NODE_DUMP_HPP
@@ -0,0 +1,55 @@
+// pre-order traversal of libclang cursors with their depths, shared by the passes walking an AST
+
+#ifndef FMTCPP_NODE_WALK_HPP
+#define FMTCPP_NODE_WALK_HPP
+
+#include <cstddef>
+#include <vector>
+#include <clang-c/Index.h>
+
+namespace fmtcpp::detail {
+
+  // state of `walk_nodes`, `ancestors` is the explicit stack replacing native recursion
+  template <typename Skip, typename Visit>
+  struct NodeWalk {
+    Skip const &skip;
+    Visit const &visit;
+    std::vector<CXCursor> ancestors;
+  };
+
+  template <typename Skip, typename Visit>
+  CXChildVisitResult visit_node(CXCursor cursor, CXCursor parent, CXClientData client_data) {
+    auto &walk = *static_cast<NodeWalk<Skip, Visit> *>(client_data);
+
+    if (walk.skip(cursor))
+      return CXChildVisit_Continue;
+
+    // libclang comes back up the tree without telling, the parent says how far
+    while (walk.ancestors.size() > 1 && !clang_equalCursors(walk.ancestors.back(), parent))
+      walk.ancestors.pop_back();
+
+    walk.visit(cursor, walk.ancestors.size() - 1);
+    walk.ancestors.push_back(cursor);
+
+    return CXChildVisit_Recurse;
+  }
+
+  // Calls `visit(cursor, depth)` for every cursor below `root` in pre-order, the children of `root`
+  // being at depth 0. Cursors for which `skip(cursor)` is true are left out along with everything
+  // below them. libclang does the descending (CXChildVisit_Recurse), so deeply nested code costs
+  // heap for the ancestor stack rather than native stack.
+  template <typename Skip, typename Visit>
+  void walk_nodes(CXCursor const root, Skip const &skip, Visit const &visit) {
+    NodeWalk<Skip, Visit> walk{ skip, visit, { root } };
+    clang_visitChildren(root, visit_node<Skip, Visit>, &walk);
+  }
+
+  // Same as above with nothing skipped.
+  template <typename Visit>
+  void walk_nodes(CXCursor const root, Visit const &visit) {
+    walk_nodes(root, [](CXCursor) { return false; }, visit);
+  }
+
+} // namespace fmtcpp::detail
+
+#endif // FMTCPP_NODE_WALK_HPP
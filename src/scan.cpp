@@ -0,0 +1,365 @@
+#include <cstdint>
+#include <cstring>
+
+#include "scan.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+  // SSE2 is part of the x86-64 baseline, AVX2 has to be detected at runtime
+  #define FMTCPP_SCAN_X86_64 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+  #endif
+#else
+  #define FMTCPP_SCAN_X86_64 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define FMTCPP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+  #define FMTCPP_TARGET_AVX2
+#endif
+
+namespace {
+
+  enum CharClass : uint8_t {
+    CLASS_WHITESPACE = 1 << 0,
+    CLASS_IDENTIFIER = 1 << 1,
+  };
+
+  struct CharClassTable {
+    uint8_t classes[256];
+
+    constexpr CharClassTable() : classes{} {
+      constexpr char const whitespace[] = { ' ', '\t', '\v', '\f' };
+      for (char const c : whitespace)
+        classes[static_cast<uint8_t>(c)] |= CLASS_WHITESPACE;
+
+      for (int c = 'a'; c <= 'z'; ++c) classes[c] |= CLASS_IDENTIFIER;
+      for (int c = 'A'; c <= 'Z'; ++c) classes[c] |= CLASS_IDENTIFIER;
+      for (int c = '0'; c <= '9'; ++c) classes[c] |= CLASS_IDENTIFIER;
+      classes[static_cast<uint8_t>('_')] |= CLASS_IDENTIFIER;
+    }
+
+    constexpr bool has(char const c, CharClass const cls) const noexcept {
+      return classes[static_cast<uint8_t>(c)] & cls;
+    }
+  };
+
+  constexpr CharClassTable s_charClasses{};
+
+  struct Kernels {
+    size_t (*countWhitespace)(char const *, size_t) noexcept;
+    size_t (*countIdentifierChars)(char const *, size_t) noexcept;
+    size_t (*findChar)(char const *, size_t, char) noexcept;
+    size_t (*findEitherChar)(char const *, size_t, char, char) noexcept;
+  };
+
+} // namespace
+
+// scalar fallbacks, also used for the tails of the vectorized versions
+
+static
+size_t count_whitespace_scalar(char const *const str, size_t const len) noexcept {
+  size_t pos = 0;
+  while (pos < len && s_charClasses.has(str[pos], CLASS_WHITESPACE))
+    ++pos;
+  return pos;
+}
+
+static
+size_t count_identifier_chars_scalar(char const *const str, size_t const len) noexcept {
+  size_t pos = 0;
+  while (pos < len && s_charClasses.has(str[pos], CLASS_IDENTIFIER))
+    ++pos;
+  return pos;
+}
+
+static
+size_t find_char_scalar(char const *const str, size_t const len, char const ch) noexcept {
+  // memchr is already vectorized by every libc worth using
+  void const *const match = std::memchr(str, ch, len);
+  return match == nullptr ? len : size_t(static_cast<char const *>(match) - str);
+}
+
+static
+size_t find_either_char_scalar(
+  char const *const str,
+  size_t const len,
+  char const ch1,
+  char const ch2
+) noexcept {
+  size_t pos = 0;
+  while (pos < len && str[pos] != ch1 && str[pos] != ch2)
+    ++pos;
+  return pos;
+}
+
+#if FMTCPP_SCAN_X86_64
+
+static
+unsigned first_set_bit(uint32_t const mask) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// SSE2, 16 bytes at a time
+
+static
+size_t count_whitespace_sse2(char const *const str, size_t const len) noexcept {
+  __m128i const space = _mm_set1_epi8(' ');
+  __m128i const tab = _mm_set1_epi8('\t');
+  __m128i const vtab = _mm_set1_epi8('\v');
+  __m128i const formFeed = _mm_set1_epi8('\f');
+
+  size_t pos = 0;
+  for (; pos + 16 <= len; pos += 16) {
+    __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + pos));
+    __m128i const isWhitespace = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, vtab), _mm_cmpeq_epi8(chunk, formFeed)));
+    uint32_t const nonWhitespace = static_cast<uint32_t>(_mm_movemask_epi8(isWhitespace)) ^ 0xFFFFu;
+    if (nonWhitespace != 0)
+      return pos + first_set_bit(nonWhitespace);
+  }
+
+  return pos + count_whitespace_scalar(str + pos, len - pos);
+}
+
+static
+size_t count_identifier_chars_sse2(char const *const str, size_t const len) noexcept {
+  // comparisons are signed, so bytes >= 0x80 are negative and never fall in range
+  __m128i const caseBit = _mm_set1_epi8(0x20);
+  __m128i const beforeLowerA = _mm_set1_epi8('a' - 1);
+  __m128i const afterLowerZ = _mm_set1_epi8('z' + 1);
+  __m128i const beforeZero = _mm_set1_epi8('0' - 1);
+  __m128i const afterNine = _mm_set1_epi8('9' + 1);
+  __m128i const underscore = _mm_set1_epi8('_');
+
+  size_t pos = 0;
+  for (; pos + 16 <= len; pos += 16) {
+    __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + pos));
+    __m128i const folded = _mm_or_si128(chunk, caseBit); // 'A'-'Z' -> 'a'-'z'
+    __m128i const isAlpha = _mm_and_si128(
+      _mm_cmpgt_epi8(folded, beforeLowerA), _mm_cmplt_epi8(folded, afterLowerZ));
+    __m128i const isDigit = _mm_and_si128(
+      _mm_cmpgt_epi8(chunk, beforeZero), _mm_cmplt_epi8(chunk, afterNine));
+    __m128i const isIdent = _mm_or_si128(
+      _mm_or_si128(isAlpha, isDigit), _mm_cmpeq_epi8(chunk, underscore));
+    uint32_t const nonIdent = static_cast<uint32_t>(_mm_movemask_epi8(isIdent)) ^ 0xFFFFu;
+    if (nonIdent != 0)
+      return pos + first_set_bit(nonIdent);
+  }
+
+  return pos + count_identifier_chars_scalar(str + pos, len - pos);
+}
+
+static
+size_t find_either_char_sse2(
+  char const *const str,
+  size_t const len,
+  char const ch1,
+  char const ch2
+) noexcept {
+  __m128i const needle1 = _mm_set1_epi8(ch1);
+  __m128i const needle2 = _mm_set1_epi8(ch2);
+
+  size_t pos = 0;
+  for (; pos + 16 <= len; pos += 16) {
+    __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + pos));
+    __m128i const matches = _mm_or_si128(
+      _mm_cmpeq_epi8(chunk, needle1), _mm_cmpeq_epi8(chunk, needle2));
+    uint32_t const mask = static_cast<uint32_t>(_mm_movemask_epi8(matches));
+    if (mask != 0)
+      return pos + first_set_bit(mask);
+  }
+
+  return pos + find_either_char_scalar(str + pos, len - pos, ch1, ch2);
+}
+
+// AVX2, 32 bytes at a time
+
+FMTCPP_TARGET_AVX2 static
+size_t count_whitespace_avx2(char const *const str, size_t const len) noexcept {
+  __m256i const space = _mm256_set1_epi8(' ');
+  __m256i const tab = _mm256_set1_epi8('\t');
+  __m256i const vtab = _mm256_set1_epi8('\v');
+  __m256i const formFeed = _mm256_set1_epi8('\f');
+
+  size_t pos = 0;
+  for (; pos + 32 <= len; pos += 32) {
+    __m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + pos));
+    __m256i const isWhitespace = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, vtab), _mm256_cmpeq_epi8(chunk, formFeed)));
+    uint32_t const nonWhitespace = ~static_cast<uint32_t>(_mm256_movemask_epi8(isWhitespace));
+    if (nonWhitespace != 0)
+      return pos + first_set_bit(nonWhitespace);
+  }
+
+  return pos + count_whitespace_sse2(str + pos, len - pos);
+}
+
+FMTCPP_TARGET_AVX2 static
+size_t count_identifier_chars_avx2(char const *const str, size_t const len) noexcept {
+  __m256i const caseBit = _mm256_set1_epi8(0x20);
+  __m256i const beforeLowerA = _mm256_set1_epi8('a' - 1);
+  __m256i const lowerZ = _mm256_set1_epi8('z');
+  __m256i const beforeZero = _mm256_set1_epi8('0' - 1);
+  __m256i const nine = _mm256_set1_epi8('9');
+  __m256i const underscore = _mm256_set1_epi8('_');
+
+  size_t pos = 0;
+  for (; pos + 32 <= len; pos += 32) {
+    __m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + pos));
+    __m256i const folded = _mm256_or_si256(chunk, caseBit);
+    // AVX2 has no cmplt, (x <= hi) is expressed as !(x > hi)
+    __m256i const isAlpha = _mm256_andnot_si256(
+      _mm256_cmpgt_epi8(folded, lowerZ), _mm256_cmpgt_epi8(folded, beforeLowerA));
+    __m256i const isDigit = _mm256_andnot_si256(
+      _mm256_cmpgt_epi8(chunk, nine), _mm256_cmpgt_epi8(chunk, beforeZero));
+    __m256i const isIdent = _mm256_or_si256(
+      _mm256_or_si256(isAlpha, isDigit), _mm256_cmpeq_epi8(chunk, underscore));
+    uint32_t const nonIdent = ~static_cast<uint32_t>(_mm256_movemask_epi8(isIdent));
+    if (nonIdent != 0)
+      return pos + first_set_bit(nonIdent);
+  }
+
+  return pos + count_identifier_chars_sse2(str + pos, len - pos);
+}
+
+FMTCPP_TARGET_AVX2 static
+size_t find_either_char_avx2(
+  char const *const str,
+  size_t const len,
+  char const ch1,
+  char const ch2
+) noexcept {
+  __m256i const needle1 = _mm256_set1_epi8(ch1);
+  __m256i const needle2 = _mm256_set1_epi8(ch2);
+
+  size_t pos = 0;
+  for (; pos + 32 <= len; pos += 32) {
+    __m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + pos));
+    __m256i const matches = _mm256_or_si256(
+      _mm256_cmpeq_epi8(chunk, needle1), _mm256_cmpeq_epi8(chunk, needle2));
+    uint32_t const mask = static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+    if (mask != 0)
+      return pos + first_set_bit(mask);
+  }
+
+  return pos + find_either_char_sse2(str + pos, len - pos, ch1, ch2);
+}
+
+static
+bool cpu_supports_avx2() noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  bool const osSavesYmm =
+    (info[2] & (1 << 27)) != 0 && // OSXSAVE
+    (_xgetbv(0) & 0x6) == 0x6;    // XMM and YMM state enabled
+  if (!osSavesYmm)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // FMTCPP_SCAN_X86_64
+
+static Kernels const s_scalarKernels {
+  count_whitespace_scalar,
+  count_identifier_chars_scalar,
+  find_char_scalar,
+  find_either_char_scalar,
+};
+
+#if FMTCPP_SCAN_X86_64
+static Kernels const s_sse2Kernels {
+  count_whitespace_sse2,
+  count_identifier_chars_sse2,
+  find_char_scalar,
+  find_either_char_sse2,
+};
+
+static Kernels const s_avx2Kernels {
+  count_whitespace_avx2,
+  count_identifier_chars_avx2,
+  find_char_scalar,
+  find_either_char_avx2,
+};
+#endif
+
+static
+scan::Isa best_supported_isa() noexcept {
+#if FMTCPP_SCAN_X86_64
+  return cpu_supports_avx2() ? scan::Isa::AVX2 : scan::Isa::SSE2;
+#else
+  return scan::Isa::SCALAR;
+#endif
+}
+
+// constant-initialized so the scanners are usable even during static initialization,
+// upgraded to the best supported implementation by `s_dispatched` below
+static Kernels const *s_kernels = &s_scalarKernels;
+static scan::Isa s_isa = scan::Isa::SCALAR;
+
+[[maybe_unused]] static bool const s_dispatched = (scan::force_isa(best_supported_isa()), true);
+
+scan::Isa scan::active_isa() noexcept {
+  return s_isa;
+}
+
+void scan::force_isa(Isa isa) noexcept {
+  Isa const best = best_supported_isa();
+  if (static_cast<int>(isa) > static_cast<int>(best))
+    isa = best;
+
+  switch (isa) {
+  #if FMTCPP_SCAN_X86_64
+    case Isa::AVX2: s_kernels = &s_avx2Kernels; break;
+    case Isa::SSE2: s_kernels = &s_sse2Kernels; break;
+  #endif
+    default:        s_kernels = &s_scalarKernels; break;
+  }
+
+  s_isa = isa;
+}
+
+char const *scan::isa_name(Isa const isa) noexcept {
+  switch (isa) {
+    case Isa::AVX2: return "avx2";
+    case Isa::SSE2: return "sse2";
+    default:        return "scalar";
+  }
+}
+
+size_t scan::count_whitespace(char const *const str, size_t const len) noexcept {
+  return s_kernels->countWhitespace(str, len);
+}
+
+size_t scan::count_identifier_chars(char const *const str, size_t const len) noexcept {
+  return s_kernels->countIdentifierChars(str, len);
+}
+
+size_t scan::find_char(char const *const str, size_t const len, char const ch) noexcept {
+  return s_kernels->findChar(str, len, ch);
+}
+
+size_t scan::find_either_char(
+  char const *const str,
+  size_t const len,
+  char const ch1,
+  char const ch2
+) noexcept {
+  return s_kernels->findEitherChar(str, len, ch1, ch2);
+}
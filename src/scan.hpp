@@ -0,0 +1,40 @@
+// vectorized byte-run scanners used by the lexer
+
+#ifndef FMTCPP_SCAN_HPP
+#define FMTCPP_SCAN_HPP
+
+#include <cstddef>
+
+namespace scan {
+
+// The instruction set the scanners below were dispatched to,
+// selected once at startup based on what the CPU supports.
+enum class Isa {
+  SCALAR = 0,
+  SSE2,
+  AVX2,
+};
+
+Isa active_isa() noexcept;
+
+// Forces a particular implementation, intended for testing/benchmarking.
+// Requesting an instruction set the CPU doesn't support falls back to the best supported one.
+void force_isa(Isa) noexcept;
+
+char const *isa_name(Isa) noexcept;
+
+// Returns the number of leading non-newline whitespace characters (' ', '\t', '\v', '\f').
+size_t count_whitespace(char const *str, size_t len) noexcept;
+
+// Returns the number of leading identifier characters ([A-Za-z0-9_]).
+size_t count_identifier_chars(char const *str, size_t len) noexcept;
+
+// Returns the position of the first occurrence of `ch`, or `len` if not found.
+size_t find_char(char const *str, size_t len, char ch) noexcept;
+
+// Returns the position of the first occurrence of either `ch1` or `ch2`, or `len` if not found.
+size_t find_either_char(char const *str, size_t len, char ch1, char ch2) noexcept;
+
+} // namespace scan
+
+#endif // FMTCPP_SCAN_HPP
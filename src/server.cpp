@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "server.hpp"
+#include "util.hpp"
+
+// state owned by one pool thread, kept warm across requests
+struct server::Service::Worker {
+  explicit Worker(fmtcpp::ParseProfile const &profile)
+  : session(profile)
+  {}
+
+  fmtcpp::Session session;
+  util::Arena arena{};
+};
+
+server::Service::Service(Options const &options)
+: m_options{options}
+, m_pool(options.numThreads)
+{
+  if (!options.cacheDir.empty())
+    m_cache = std::make_unique<fmtcpp::FormatCache>(options.cacheDir);
+
+  // created on first use by the pool thread owning it
+  m_workers.resize(m_pool.num_threads());
+}
+
+server::Service::~Service() = default;
+
+std::vector<server::Response> server::Service::handle(std::vector<Request> const &batch) {
+  std::vector<Response> responses(batch.size());
+
+  // the pool is shared with other connections, so wait for this batch only
+  std::mutex mutex{};
+  std::condition_variable allDone{};
+  size_t numPending = batch.size();
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    m_pool.submit([&, i](size_t const workerIdx) {
+      try {
+        auto &worker = m_workers[workerIdx];
+        if (worker == nullptr)
+          worker = std::make_unique<Worker>(m_options.parseProfile);
+        responses[i] = serve(batch[i], *worker);
+      } catch (std::exception const &err) {
+        responses[i] = Response{ResponseStatus::ERROR, batch[i].path + ": " + err.what()};
+      }
+
+      std::lock_guard const lock(mutex);
+      if (--numPending == 0)
+        allDone.notify_one();
+    });
+  }
+
+  std::unique_lock lock(mutex);
+  allDone.wait(lock, [&] { return numPending == 0; });
+
+  return responses;
+}
+
+server::Response server::Service::serve(Request const &request, Worker &worker) {
+  // whatever the previous request left in there is dead
+  worker.arena.reset();
+
+  auto const &formatOptions = m_options.formatOptions;
+  Response response{};
+
+  switch (request.kind) {
+    case RequestKind::FORMAT: {
+      std::string formatted{};
+      bool isChanged;
+      if (m_cache != nullptr) {
+        isChanged = fmtcpp::format_source_code(request.source, formatOptions, *m_cache, worker.arena, formatted);
+      } else {
+        formatted = fmtcpp::format_source_code(request.source, formatOptions, worker.arena);
+        isChanged = formatted != request.source;
+      }
+      if (isChanged) {
+        response.status = ResponseStatus::CHANGED;
+        response.payload = std::move(formatted);
+      } else {
+        response.status = ResponseStatus::UNCHANGED;
+      }
+      break;
+    }
+
+    case RequestKind::CHECK:
+      response.status = fmtcpp::is_formatted(request.source, formatOptions, worker.arena)
+        ? ResponseStatus::UNCHANGED : ResponseStatus::CHANGED;
+      break;
+
+    case RequestKind::EDITS: {
+      auto const edits = fmtcpp::format_edits(request.source, formatOptions, worker.arena);
+      response.status = edits.empty() ? ResponseStatus::UNCHANGED : ResponseStatus::CHANGED;
+      for (auto const &edit : edits) {
+        response.payload += fmtcpp::describe_edit(edit);
+        response.payload += '\n';
+      }
+      break;
+    }
+
+    case RequestKind::NODES: {
+      // the translation unit stays cached, so the next request for the path reuses its preamble
+      std::ostringstream nodes{};
+      fmtcpp::print_nodes(worker.session, request.path, request.source, nodes);
+      response.status = ResponseStatus::OK;
+      response.payload = std::move(nodes).str();
+      break;
+    }
+
+    default:
+      throw std::runtime_error("unknown request kind");
+  }
+
+  return response;
+}
+
+static constexpr std::string_view s_kindNames[] = { "FORMAT", "CHECK", "EDITS", "NODES" };
+static constexpr std::string_view s_statusNames[] = { "OK", "CHANGED", "UNCHANGED", "ERROR" };
+
+bool server::detail::parse_request_line(std::string_view line, Request &out, size_t &sourceLen) {
+  size_t const kindEnd = line.find(' ');
+  if (kindEnd == std::string_view::npos)
+    return false;
+
+  auto const kind = std::find(std::begin(s_kindNames), std::end(s_kindNames), line.substr(0, kindEnd));
+  if (kind == std::end(s_kindNames))
+    return false;
+
+  line.remove_prefix(kindEnd + 1);
+  auto const [lenEnd, err] = std::from_chars(line.data(), line.data() + line.length(), sourceLen);
+  if (err != std::errc{} || lenEnd == line.data() || lenEnd == line.data() + line.length() || *lenEnd != ' ')
+    return false;
+  line.remove_prefix(static_cast<size_t>(lenEnd - line.data()) + 1);
+
+  if (line.empty())
+    return false;
+
+  out.kind = static_cast<RequestKind>(kind - std::begin(s_kindNames));
+  out.path = line;
+  return true;
+}
+
+void server::detail::append_response(std::string &out, Response const &response) {
+  out += s_statusNames[static_cast<size_t>(response.status)];
+  out += ' ';
+  out += std::to_string(response.payload.length());
+  out += '\n';
+  out += response.payload;
+}
+
+#if !defined(_WIN32)
+
+namespace {
+
+  // longest request line accepted, paths included
+  constexpr size_t MAX_LINE_LEN = 64 * 1024;
+
+  class SocketReader {
+    public:
+      explicit SocketReader(int const fd)
+      : m_fd{fd}
+      {}
+
+      // False on end of stream, error, or a line longer than MAX_LINE_LEN.
+      bool read_line(std::string &out) {
+        for (;;) {
+          size_t const newline = m_buffer.find('\n', m_pos);
+          if (newline != std::string::npos) {
+            out.assign(m_buffer, m_pos, newline - m_pos);
+            m_pos = newline + 1;
+            return true;
+          }
+          if (m_buffer.length() - m_pos > MAX_LINE_LEN || !fill())
+            return false;
+        }
+      }
+
+      bool read_exact(size_t const len, std::string &out) {
+        // grows with what arrives rather than with what the client claims
+        out.clear();
+        for (;;) {
+          size_t const take = std::min(len - out.length(), m_buffer.length() - m_pos);
+          out.append(m_buffer, m_pos, take);
+          m_pos += take;
+          if (out.length() == len)
+            return true;
+          if (!fill())
+            return false;
+        }
+      }
+
+    private:
+      bool fill() {
+        m_buffer.erase(0, m_pos);
+        m_pos = 0;
+
+        char chunk[64 * 1024];
+        ssize_t numRead;
+        do {
+          numRead = ::read(m_fd, chunk, sizeof(chunk));
+        } while (numRead < 0 && errno == EINTR);
+
+        if (numRead <= 0)
+          return false;
+        m_buffer.append(chunk, static_cast<size_t>(numRead));
+        return true;
+      }
+
+      int m_fd;
+      std::string m_buffer{};
+      size_t m_pos = 0;
+  };
+
+  struct Connection {
+    int fd;
+    std::thread thread{};
+    std::atomic<bool> isDone = false;
+  };
+
+  // shared by the accepting thread and the connection threads
+  struct Listener {
+    std::string socketPath;
+    int fd = -1;
+    std::atomic<bool> isStopping = false;
+  };
+
+} // namespace
+
+static
+bool write_all(int const fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    ssize_t const numWritten = ::write(fd, bytes.data(), bytes.length());
+    if (numWritten < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes.remove_prefix(static_cast<size_t>(numWritten));
+  }
+  return true;
+}
+
+static
+sockaddr_un make_address(std::string const &socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.length() >= sizeof(address.sun_path))
+    throw std::runtime_error(util::make_str("socket path '%s' is too long", socketPath.c_str()));
+  std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+  return address;
+}
+
+// -1 if nothing accepts connections at the address
+static
+int connect_to(sockaddr_un const &address) {
+  int const fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (::connect(fd, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// answers ERROR, after which the connection is closed
+static
+void write_error(int const fd, std::string const &message) {
+  std::string out{};
+  server::detail::append_response(out, { server::ResponseStatus::ERROR, message });
+  write_all(fd, out);
+}
+
+static
+void serve_requests(server::Service &service, Listener &listener, int const fd, size_t const maxSourceLen) {
+  SocketReader reader(fd);
+  std::vector<server::Request> batch{};
+  std::string line{};
+  std::string out{};
+
+  for (;;) {
+    if (!reader.read_line(line))
+      return;
+
+    bool const isShutdown = line == "SHUTDOWN";
+    if (line != "END" && !isShutdown) {
+      server::Request request{};
+      size_t sourceLen;
+      if (!server::detail::parse_request_line(line, request, sourceLen)) {
+        write_error(fd, "malformed request");
+        return;
+      }
+      if (sourceLen > maxSourceLen) {
+        write_error(fd, util::make_str("source longer than %zu bytes", maxSourceLen));
+        return;
+      }
+      if (!reader.read_exact(sourceLen, request.source))
+        return;
+      batch.push_back(std::move(request));
+      continue;
+    }
+
+    out.clear();
+    for (auto const &response : service.handle(batch))
+      server::detail::append_response(out, response);
+    batch.clear();
+
+    bool const isWritten = write_all(fd, out);
+
+    if (isShutdown) {
+      listener.isStopping = true;
+      // wake up accept
+      int const wakeup = connect_to(make_address(listener.socketPath));
+      if (wakeup >= 0)
+        ::close(wakeup);
+      return;
+    }
+    if (!isWritten)
+      return;
+  }
+}
+
+// whatever goes wrong with one connection (e.g. running out of memory) only ends that one
+static
+void serve_connection(server::Service &service, Listener &listener, int const fd, size_t const maxSourceLen) {
+  try {
+    serve_requests(service, listener, fd, maxSourceLen);
+  } catch (std::exception const &err) {
+    write_error(fd, err.what());
+  }
+  // the client sees the connection end now, the fd is closed once the thread is joined
+  ::shutdown(fd, SHUT_RDWR);
+}
+
+void server::run(Options const &options) {
+  auto const address = make_address(options.socketPath);
+
+  // a socket file left by a daemon which didn't exit cleanly is stale once nothing answers there
+  if (int const existing = connect_to(address); existing >= 0) {
+    ::close(existing);
+    throw std::runtime_error(util::make_str("a daemon is already listening on '%s'", options.socketPath.c_str()));
+  }
+  ::unlink(options.socketPath.c_str());
+
+  Listener listener{options.socketPath};
+  listener.fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener.fd < 0)
+    throw std::runtime_error("unable to create socket");
+
+  if (
+    ::bind(listener.fd, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0 ||
+    ::listen(listener.fd, SOMAXCONN) != 0
+  ) {
+    ::close(listener.fd);
+    throw std::runtime_error(util::make_str("unable to listen on '%s'", options.socketPath.c_str()));
+  }
+
+  // a client hanging up mid-response must not kill the daemon
+  std::signal(SIGPIPE, SIG_IGN);
+
+  Service service(options);
+  std::list<Connection> connections{};
+
+  while (!listener.isStopping) {
+    int const fd = ::accept(listener.fd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    if (listener.isStopping) {
+      ::close(fd);
+      break;
+    }
+
+    // join the threads of connections which ended
+    connections.remove_if([](Connection &conn) {
+      if (!conn.isDone)
+        return false;
+      conn.thread.join();
+      ::close(conn.fd);
+      return true;
+    });
+
+    auto &conn = connections.emplace_back(fd);
+    conn.thread = std::thread([&service, &listener, &conn, maxSourceLen = options.maxSourceLen] {
+      serve_connection(service, listener, conn.fd, maxSourceLen);
+      conn.isDone = true;
+    });
+  }
+
+  ::close(listener.fd);
+  ::unlink(options.socketPath.c_str());
+
+  // unblock connections waiting for their next request
+  for (auto &conn : connections)
+    ::shutdown(conn.fd, SHUT_RDWR);
+  for (auto &conn : connections) {
+    conn.thread.join();
+    ::close(conn.fd);
+  }
+}
+
+#else
+
+void server::run(Options const &) {
+  throw std::runtime_error("--daemon needs Unix domain sockets");
+}
+
+#endif
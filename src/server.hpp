@@ -0,0 +1,104 @@
+// long-running formatting service, used by `fmtcpp --daemon`
+
+#ifndef FMTCPP_SERVER_HPP
+#define FMTCPP_SERVER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fmtcpp.hpp"
+#include "format_cache.hpp"
+#include "thread_pool.hpp"
+
+namespace server {
+
+struct Options {
+  std::string socketPath{};
+  size_t numThreads = 0;  // 0 means one per hardware thread
+  std::string cacheDir{}; // directory of the fmtcpp::FormatCache, empty means no caching
+  fmtcpp::FormatOptions formatOptions{};
+  fmtcpp::ParseProfile parseProfile{};
+  size_t maxSourceLen = size_t(256) << 20; // requests with a longer source are answered with ERROR
+};
+
+enum class RequestKind : uint8_t {
+  FORMAT, // respond with the formatted source (nothing if it is UNCHANGED)
+  CHECK,  // respond with nothing, the status tells
+  EDITS,  // respond with the edits, one fmtcpp::describe_edit line each
+  NODES,  // respond with the print_nodes text
+};
+
+struct Request {
+  RequestKind kind = RequestKind::FORMAT;
+  std::string path{}; // resolves #includes for NODES, names the file in errors
+  std::string source{};
+};
+
+enum class ResponseStatus : uint8_t {
+  OK,        // NODES
+  CHANGED,   // formatting changes the source
+  UNCHANGED, // it is already formatted
+  ERROR,     // the payload is the message
+};
+
+struct Response {
+  ResponseStatus status = ResponseStatus::OK;
+  std::string payload{};
+};
+
+// The warm state of the daemon, usable without a socket: a thread pool where every
+// worker keeps its libclang session (with the precompiled preambles of the paths it
+// parsed) and arena, and the format cache.
+class Service {
+  public:
+    explicit Service(Options const &);
+    ~Service();
+
+    Service(Service const &) = delete;
+    Service &operator=(Service const &) = delete;
+
+    // Serves the requests concurrently, returns the responses in the same order.
+    // Many threads may call this at once.
+    std::vector<Response> handle(std::vector<Request> const &batch);
+
+  private:
+    struct Worker;
+
+    Response serve(Request const &, Worker &);
+
+    Options m_options;
+    std::unique_ptr<fmtcpp::FormatCache> m_cache{};
+    std::vector<std::unique_ptr<Worker>> m_workers{};
+    util::WorkStealingPool m_pool; // last, so it is stopped before the workers go away
+};
+
+// Serves requests on a Unix domain socket at `options.socketPath` until a client asks it
+// to shut down. A stale socket file (no daemon answering) is replaced.
+// Throws std::runtime_error when the socket can't be set up, and on platforms without
+// Unix domain sockets.
+//
+// Protocol: a connection carries any number of batches, a batch is any number of requests
+// followed by the line "END". Once a whole batch is read its requests are served concurrently
+// and the responses are written back in request order.
+//   request:  <FORMAT|CHECK|EDITS|NODES> <source length> <path>\n<source bytes>
+//   response: <OK|CHANGED|UNCHANGED|ERROR> <payload length>\n<payload bytes>
+// The line "SHUTDOWN" ends the batch like "END" does and stops the daemon after answering it.
+// A malformed request, one whose source is longer than `options.maxSourceLen`, or a failure
+// reading it is answered with ERROR and the connection is closed.
+void run(Options const &options);
+
+namespace detail {
+
+  // Parses "<KIND> <source length> <path>" into `out` (except its source). False if malformed.
+  bool parse_request_line(std::string_view line, Request &out, size_t &sourceLen);
+
+  void append_response(std::string &out, Response const &);
+
+} // namespace detail
+
+} // namespace server
+
+#endif // FMTCPP_SERVER_HPP
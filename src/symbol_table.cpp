@@ -0,0 +1,413 @@
+#include <filesystem>
+#include <system_error>
+#include <unordered_set>
+
+#include "lexer.hpp"
+#include "symbol_table.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+using fmtcpp::SymbolKind;
+
+char const *fmtcpp::symbol_kind_name(SymbolKind const kind) {
+  switch (kind) {
+    case SymbolKind::MACRO:     return "MACRO";
+    case SymbolKind::TYPEDEF:   return "TYPEDEF";
+    case SymbolKind::USING:     return "USING";
+    case SymbolKind::NAMESPACE: return "NAMESPACE";
+    case SymbolKind::STRUCT:    return "STRUCT";
+    case SymbolKind::CLASS:     return "CLASS";
+    case SymbolKind::UNION:     return "UNION";
+    case SymbolKind::ENUM:      return "ENUM";
+    case SymbolKind::FUNCTION:  return "FUNCTION";
+    case SymbolKind::CONCEPT:   return "CONCEPT";
+    case SymbolKind::VARIABLE:  return "VARIABLE";
+    default:                    return "NONE";
+  }
+}
+
+size_t fmtcpp::SymbolTable::NameHash::operator()(std::string_view const name) const noexcept {
+  return std::hash<std::string_view>{}(name);
+}
+
+void fmtcpp::SymbolTable::add(std::string_view const name, SymbolKind const kind) {
+  auto const add_once = [this, kind](std::string_view const key) {
+    if (m_kinds.find(key) == m_kinds.end())
+      m_kinds.emplace(std::string(key), kind);
+  };
+
+  add_once(name);
+
+  size_t const lastSeparator = name.rfind("::");
+  if (lastSeparator != std::string_view::npos)
+    add_once(name.substr(lastSeparator + 2));
+}
+
+SymbolKind fmtcpp::SymbolTable::lookup(std::string_view const name) const {
+  auto const found = m_kinds.find(name);
+  return found == m_kinds.end() ? SymbolKind::NONE : found->second;
+}
+
+size_t fmtcpp::SymbolTable::size() const noexcept {
+  return m_kinds.size();
+}
+
+// entry formats, bump the trailing version byte when changing either
+static constexpr std::string_view s_headerMagic = "FSYH\x01";
+static constexpr std::string_view s_manifestMagic = "FSYI\x01";
+
+static
+void append_string(std::string &out, std::string_view const str) {
+  util::append_varint(out, str.length());
+  out += str;
+}
+
+static
+bool read_string(std::string_view const bytes, size_t &pos, std::string &out) {
+  uint64_t len;
+  if (!util::read_varint(bytes, pos, len) || len > bytes.length() - pos)
+    return false;
+  out.assign(bytes.substr(pos, len));
+  pos += len;
+  return true;
+}
+
+std::string fmtcpp::detail::encode_header_symbols(HeaderSymbols const &header) {
+  std::string bytes(s_headerMagic);
+  append_string(bytes, header.path);
+  util::append_varint(bytes, static_cast<uint64_t>(header.mtime));
+  util::append_varint(bytes, header.symbols.size());
+  for (auto const &[name, kind] : header.symbols) {
+    bytes += static_cast<char>(kind);
+    append_string(bytes, name);
+  }
+  return bytes;
+}
+
+bool fmtcpp::detail::decode_header_symbols(std::string_view const bytes, HeaderSymbols &out) {
+  if (!bytes.starts_with(s_headerMagic))
+    return false;
+
+  size_t pos = s_headerMagic.length();
+  uint64_t mtime, numSymbols;
+  if (!read_string(bytes, pos, out.path) || !util::read_varint(bytes, pos, mtime) || !util::read_varint(bytes, pos, numSymbols))
+    return false;
+  out.mtime = static_cast<int64_t>(mtime);
+
+  out.symbols.clear();
+  for (uint64_t i = 0; i < numSymbols; ++i) {
+    if (pos >= bytes.length() || static_cast<uint8_t>(bytes[pos]) >= static_cast<uint8_t>(SymbolKind::COUNT))
+      return false;
+    auto const kind = static_cast<SymbolKind>(bytes[pos++]);
+
+    std::string name{};
+    if (!read_string(bytes, pos, name))
+      return false;
+    out.symbols.emplace_back(std::move(name), kind);
+  }
+
+  return pos == bytes.length();
+}
+
+// every header reached from a set of directives, with the mtime it was indexed at
+using Manifest = std::vector<std::pair<std::string, int64_t>>;
+
+static
+std::string encode_manifest(Manifest const &manifest) {
+  std::string bytes(s_manifestMagic);
+  util::append_varint(bytes, manifest.size());
+  for (auto const &[path, mtime] : manifest) {
+    append_string(bytes, path);
+    util::append_varint(bytes, static_cast<uint64_t>(mtime));
+  }
+  return bytes;
+}
+
+static
+bool decode_manifest(std::string_view const bytes, Manifest &out) {
+  if (!bytes.starts_with(s_manifestMagic))
+    return false;
+
+  size_t pos = s_manifestMagic.length();
+  uint64_t numHeaders;
+  if (!util::read_varint(bytes, pos, numHeaders))
+    return false;
+
+  out.clear();
+  for (uint64_t i = 0; i < numHeaders; ++i) {
+    std::string path{};
+    uint64_t mtime;
+    if (!read_string(bytes, pos, path) || !util::read_varint(bytes, pos, mtime))
+      return false;
+    out.emplace_back(std::move(path), static_cast<int64_t>(mtime));
+  }
+
+  return pos == bytes.length();
+}
+
+static
+int64_t mtime_of(std::string const &path) {
+  std::error_code err{};
+  auto const time = fs::last_write_time(path, err);
+  return err ? -1 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// the same header may be reached through differently spelled paths, and from different working directories
+static
+std::string normalized(std::string const &path) {
+  std::error_code err{};
+  fs::path const absolute = fs::absolute(path, err);
+  return (err ? fs::path(path) : absolute).lexically_normal().generic_string();
+}
+
+static
+std::string key_of(std::string_view const bytes) {
+  // what a header declares is independent of the formatting options, but not of how it is extracted
+  return util::content_key(bytes, util::hash_bytes(fmtcpp::VERSION));
+}
+
+namespace {
+
+  struct SymbolCollector {
+    std::string main_file;  // the parsed directives, their own macros are already known
+    std::string scope{};    // qualification of the namespace being visited, e.g. "math1::types::"
+    std::unordered_map<std::string, std::vector<std::pair<std::string, SymbolKind>>> by_file{};
+  };
+
+} // namespace
+
+static
+SymbolKind symbol_kind_of(CXCursor const cursor) {
+  CXCursorKind cursor_kind = clang_getCursorKind(cursor);
+  if (cursor_kind == CXCursor_ClassTemplate)
+    cursor_kind = clang_getTemplateCursorKind(cursor);
+
+  switch (cursor_kind) {
+    case CXCursor_MacroDefinition:       return SymbolKind::MACRO;
+    case CXCursor_TypedefDecl:           return SymbolKind::TYPEDEF;
+    case CXCursor_TypeAliasDecl:
+    case CXCursor_TypeAliasTemplateDecl: return SymbolKind::USING;
+    case CXCursor_Namespace:
+    case CXCursor_NamespaceAlias:        return SymbolKind::NAMESPACE;
+    case CXCursor_StructDecl:            return SymbolKind::STRUCT;
+    case CXCursor_ClassDecl:             return SymbolKind::CLASS;
+    case CXCursor_UnionDecl:             return SymbolKind::UNION;
+    case CXCursor_EnumDecl:              return SymbolKind::ENUM;
+    case CXCursor_FunctionDecl:
+    case CXCursor_FunctionTemplate:      return SymbolKind::FUNCTION;
+    case CXCursor_ConceptDecl:           return SymbolKind::CONCEPT;
+    case CXCursor_VarDecl:               return SymbolKind::VARIABLE;
+    default:                             return SymbolKind::NONE;
+  }
+}
+
+// visits the declarations at namespace scope and the macro definitions
+static
+CXChildVisitResult collect_symbol(
+  CXCursor cursor,
+  [[maybe_unused]] CXCursor parent,
+  CXClientData client_data
+) {
+  auto &collector = *static_cast<SymbolCollector *>(client_data);
+
+  // extern "C" { ... } doesn't open a scope
+  if (clang_getCursorKind(cursor) == CXCursor_LinkageSpec)
+    return CXChildVisit_Recurse;
+
+  SymbolKind const kind = symbol_kind_of(cursor);
+  if (kind == SymbolKind::NONE)
+    return CXChildVisit_Continue;
+
+  CXFile file = nullptr;
+  clang_getSpellingLocation(clang_getCursorLocation(cursor), &file, nullptr, nullptr, nullptr);
+  // builtin macros
+  if (file == nullptr)
+    return CXChildVisit_Continue;
+
+  CXString file_name = clang_getFileName(file);
+  CXString cursor_spelling = clang_getCursorSpelling(cursor);
+  char const *const file_path = clang_getCString(file_name);
+  std::string const path = file_path == nullptr ? "" : file_path;
+  std::string const name = clang_getCString(cursor_spelling);
+  clang_disposeString(file_name);
+  clang_disposeString(cursor_spelling);
+
+  std::string const qualified = collector.scope + name;
+  // anonymous structs, enums... can't be referred to by name
+  if (!name.empty() && path != collector.main_file)
+    collector.by_file[path].emplace_back(qualified, kind);
+
+  if (clang_getCursorKind(cursor) == CXCursor_Namespace) {
+    size_t const scope_len = collector.scope.length();
+    // members of anonymous namespaces are named as if they were in the enclosing one
+    if (!name.empty())
+      collector.scope = qualified + "::";
+    clang_visitChildren(cursor, collect_symbol, client_data);
+    collector.scope.resize(scope_len);
+  }
+
+  return CXChildVisit_Continue;
+}
+
+static
+void collect_inclusion(
+  CXFile included_file,
+  [[maybe_unused]] CXSourceLocation *inclusion_stack,
+  unsigned const include_len,
+  CXClientData client_data
+) {
+  // the main file itself
+  if (include_len == 0)
+    return;
+
+  CXString file_name = clang_getFileName(included_file);
+  if (char const *const path = clang_getCString(file_name))
+    static_cast<std::vector<std::string> *>(client_data)->emplace_back(path);
+  clang_disposeString(file_name);
+}
+
+fmtcpp::SymbolIndex::SymbolIndex(std::string directory)
+: m_directory(std::move(directory))
+{}
+
+fmtcpp::SymbolTable fmtcpp::SymbolIndex::symbols_for(
+  Session &session,
+  std::string const &path,
+  std::string_view const source
+) {
+  lexer::PreproIndex prepro{};
+  lexer::tokenize_text(source.data(), source.length(), prepro);
+  return symbols_for(session, path, source, prepro);
+}
+
+fmtcpp::SymbolTable fmtcpp::SymbolIndex::symbols_for(
+  Session &session,
+  std::string const &path,
+  std::string_view const source,
+  lexer::PreproIndex const &prepro
+) {
+  SymbolTable table{};
+
+  // which headers are reached only depends on the directives, so the rest of the file is never parsed
+  std::string directives{};
+  for (auto const &tok : prepro.directives())
+    directives.append(source.substr(tok.position(), tok.length())).append("\n");
+
+  for (auto const &define : prepro.defines())
+    table.add(define.name, SymbolKind::MACRO);
+
+  // include paths and defines change what is reached and declared
+  ParseProfile const profile = session.profile().for_symbols();
+  std::string const profileKey = util::make_str("%016llx\n", static_cast<unsigned long long>(profile.fingerprint()));
+
+  // "..." includes resolve against the includer's directory, so that is part of the key
+  std::string const includerDir = fs::path(normalized(path)).parent_path().generic_string();
+  std::string const manifestPath =
+    util::sharded_entry_path(m_directory, key_of(profileKey + includerDir + '\n' + directives), ".inc");
+
+  Manifest manifest{};
+  auto const manifestEntry = util::read_entry(manifestPath);
+  bool isUpToDate = manifestEntry && decode_manifest(manifestEntry->view(), manifest);
+
+  std::vector<HeaderPtr> headers{};
+  for (auto const &[headerPath, mtime] : manifest) {
+    HeaderPtr header = isUpToDate && mtime_of(headerPath) == mtime ? load_header(profileKey, headerPath, mtime) : nullptr;
+    if (header == nullptr) {
+      isUpToDate = false;
+      break;
+    }
+    headers.push_back(std::move(header));
+  }
+
+  if (!isUpToDate)
+    headers = index_headers(session, profile, profileKey, path, directives, manifestPath);
+
+  for (auto const &header : headers) {
+    for (auto const &[name, kind] : header->symbols)
+      table.add(name, kind);
+  }
+
+  return table;
+}
+
+std::string const &fmtcpp::SymbolIndex::directory() const noexcept {
+  return m_directory;
+}
+
+fmtcpp::SymbolIndex::HeaderPtr fmtcpp::SymbolIndex::load_header(
+  std::string const &profileKey,
+  std::string const &path,
+  int64_t const mtime
+) {
+  std::string const key = profileKey + path;
+  {
+    std::lock_guard const lock(m_mutex);
+    auto const loaded = m_headers.find(key);
+    if (loaded != m_headers.end() && loaded->second->mtime == mtime)
+      return loaded->second;
+  }
+
+  auto header = std::make_shared<HeaderSymbols>();
+  auto const entry = util::read_entry(util::sharded_entry_path(m_directory, key_of(key), ".hdr"));
+  if (!entry || !detail::decode_header_symbols(entry->view(), *header) || header->path != path || header->mtime != mtime)
+    return nullptr;
+
+  std::lock_guard const lock(m_mutex);
+  m_headers[key] = header;
+  return header;
+}
+
+std::vector<fmtcpp::SymbolIndex::HeaderPtr> fmtcpp::SymbolIndex::index_headers(
+  Session &session,
+  ParseProfile const &profile,
+  std::string const &profileKey,
+  std::string const &path,
+  std::string const &directives,
+  std::string const &manifestPath
+) {
+  // parsed as the contents of a file next to `path`, so relative #includes resolve the same way
+  std::string const directivesPath = path + ".directives.cpp";
+
+  CXTranslationUnit transl_unit = nullptr;
+  if (session.parse(directivesPath, directives, profile, transl_unit) != CXError_Success)
+    return {};
+
+  SymbolCollector collector{ directivesPath };
+  clang_visitChildren(clang_getTranslationUnitCursor(transl_unit), collect_symbol, &collector);
+
+  std::vector<std::string> includedPaths{};
+  clang_getInclusions(transl_unit, collect_inclusion, &includedPaths);
+
+  // from now on the index answers for these directives
+  session.evict(directivesPath);
+
+  std::vector<HeaderPtr> headers{};
+  Manifest manifest{};
+  std::unordered_set<std::string> seen{};
+
+  for (auto const &includedPath : includedPaths) {
+    auto header = std::make_shared<HeaderSymbols>();
+    header->path = normalized(includedPath);
+    if (!seen.insert(header->path).second)
+      continue;
+
+    header->mtime = mtime_of(header->path);
+    auto const symbols = collector.by_file.find(includedPath);
+    if (symbols != collector.by_file.end())
+      header->symbols = std::move(symbols->second);
+
+    std::string const key = profileKey + header->path;
+    util::write_entry(util::sharded_entry_path(m_directory, key_of(key), ".hdr"), detail::encode_header_symbols(*header));
+    manifest.emplace_back(header->path, header->mtime);
+
+    {
+      std::lock_guard const lock(m_mutex);
+      m_headers[key] = header;
+    }
+    headers.push_back(std::move(header));
+  }
+
+  util::write_entry(manifestPath, encode_manifest(manifest));
+  return headers;
+}
@@ -0,0 +1,135 @@
+#ifndef FMTCPP_SYMBOL_TABLE_HPP
+#define FMTCPP_SYMBOL_TABLE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fmtcpp.hpp"
+#include "lexer.hpp"
+
+namespace fmtcpp {
+
+// What a name declared in a header is, as far as formatting cares.
+enum class SymbolKind : uint8_t {
+  NONE = 0,
+  MACRO,
+  TYPEDEF,
+  USING, // type alias
+  NAMESPACE,
+  STRUCT,
+  CLASS,
+  UNION,
+  ENUM,
+  FUNCTION,
+  CONCEPT,
+  VARIABLE,
+
+  COUNT
+};
+
+// e.g. "TYPEDEF", as in test_files/ex1/sample_symbol_table.txt
+char const *symbol_kind_name(SymbolKind);
+
+// Kinds of the names visible to a file. Every name is registered as declared (qualified,
+// e.g. math1::types::Point2D) and by its last component, the first declaration of a name wins.
+class SymbolTable {
+  public:
+    void add(std::string_view name, SymbolKind);
+
+    // NONE for unknown names.
+    SymbolKind lookup(std::string_view name) const;
+
+    size_t size() const noexcept;
+
+  private:
+    // lets `lookup` hash a string_view without building a std::string
+    struct NameHash {
+      using is_transparent = void;
+      size_t operator()(std::string_view name) const noexcept;
+    };
+
+    std::unordered_map<std::string, SymbolKind, NameHash, std::equal_to<>> m_kinds{};
+};
+
+// The names one header declares (not counting those of the headers it includes), in declaration order.
+struct HeaderSymbols {
+  std::string path{};
+  int64_t mtime = 0;
+  std::vector<std::pair<std::string, SymbolKind>> symbols{};
+};
+
+// Persistent index of what #included headers declare, so the (often huge) dependency graph of a
+// file is parsed once rather than for every file, or every time the same file is formatted.
+// Layout: <directory>/<2 chars of key>/<key>.hdr  - HeaderSymbols of one header, keyed by its path,
+//                                                   valid while the header's mtime is unchanged
+//         <directory>/<2 chars of key>/<key>.inc  - every header (path + mtime) reached from a set of
+//                                                   directives, keyed by them and the includer's directory
+// Entries are written atomically and never modified, so one directory may be used by many threads
+// and processes at once. A corrupt or unreadable entry is treated as a miss.
+class SymbolIndex {
+  public:
+    // The directory is created on the first store.
+    explicit SymbolIndex(std::string directory);
+
+    // Returns the symbols visible to `source` as the contents of `path`: the macros it defines and
+    // everything the headers it includes declare. Only when its preprocessor directives are new,
+    // or a header they reach changed, are the directives (not the whole file) parsed through
+    // `session`, which also indexes every header reached. Parsing uses the session's profile made
+    // symbols-only (ParseProfile::for_symbols), entries are specific to that profile.
+    // Safe to call from many threads, each with its own session.
+    SymbolTable symbols_for(Session &session, std::string const &path, std::string_view source);
+
+    // Same as above, with the directives taken from `prepro`, the index of `source` filled when it
+    // was lexed, rather than lexing it again.
+    SymbolTable symbols_for(
+      Session &session,
+      std::string const &path,
+      std::string_view source,
+      lexer::PreproIndex const &prepro
+    );
+
+    std::string const &directory() const noexcept;
+
+  private:
+    using HeaderPtr = std::shared_ptr<HeaderSymbols const>;
+
+    // nullptr unless the index holds the symbols of `path` as of `mtime`, `profileKey` identifies
+    // the parse profile
+    HeaderPtr load_header(std::string const &profileKey, std::string const &path, int64_t mtime);
+
+    // parses `directives` next to `path`, indexes every header reached and returns them
+    std::vector<HeaderPtr> index_headers(
+      Session &session,
+      ParseProfile const &profile,
+      std::string const &profileKey,
+      std::string const &path,
+      std::string const &directives,
+      std::string const &manifestPath
+    );
+
+    std::string m_directory;
+    std::mutex m_mutex{};
+    // headers loaded or indexed so far, by profile key + path
+    std::unordered_map<std::string, HeaderPtr> m_headers{};
+};
+
+namespace detail {
+
+  // Compact binary encoding of .hdr entries: a magic, then path, mtime and symbols
+  // as varint-length-prefixed strings and varints.
+  std::string encode_header_symbols(HeaderSymbols const &);
+
+  // False if `bytes` isn't a complete entry.
+  bool decode_header_symbols(std::string_view bytes, HeaderSymbols &out);
+
+} // namespace detail
+
+} // namespace fmtcpp
+
+#endif // FMTCPP_SYMBOL_TABLE_HPP
@@ -8,10 +8,20 @@
 #include <cassert>
 
 #include "ntest.hpp"
+#include "ambiguity.hpp"
+#include "arena.hpp"
+#include "cursor_index.hpp"
+#include "driver.hpp"
 #include "lexer.hpp"
+#include "scan.hpp"
 #include "util.hpp"
 #include "term.hpp"
 #include "fmtcpp.hpp"
+#include "format_cache.hpp"
+#include "formatter.hpp"
+#include "node_dump.hpp"
+#include "server.hpp"
+#include "symbol_table.hpp"
 
 int main() {
   using namespace term;
@@ -36,17 +46,633 @@ int main() {
   {
     std::ofstream file("test_files/ex1/math1.nodes");
     assert((bool)file);
-    std::string const source_code = util::extract_txt_file_contents("test_files/ex1/math1.hpp");
-    fmtcpp::print_nodes(source_code, file);
+    util::MappedFile const source_code("test_files/ex1/math1.hpp");
+    fmtcpp::print_nodes(source_code.view(), file);
   }
   {
     std::ofstream file("test_files/ex1/math2.nodes");
     assert((bool)file);
-    std::string const source_code = util::extract_txt_file_contents("test_files/ex1/math2.hpp");
-    fmtcpp::print_nodes(source_code, file);
+    util::MappedFile const source_code("test_files/ex1/math2.hpp");
+    fmtcpp::print_nodes(source_code.view(), file);
   }
 
-  #if 0 // lexer
+  // util
+  {
+    // "a\"b\\" c" -> after the opening quote, the first unescaped one follows the escaped backslash
+    std::string const text = R"("a\"b\\" c")";
+    ntest::assert_uint64(0, util::find_unescaped(text.c_str(), text.length(), '"', '\\'));
+    ntest::assert_uint64(7, util::find_unescaped(text.c_str(), text.length(), '"', '\\', 1));
+    ntest::assert_uint64(std::string::npos, util::find_unescaped(text.c_str(), 7, '"', '\\', 1));
+  }
+
+  // driver
+  {
+    using driver::detail::matches_glob;
+
+    ntest::assert_bool(true, matches_glob("*.cpp", "lexer.cpp"));
+    ntest::assert_bool(false, matches_glob("*.cpp", "src/lexer.cpp"));
+    ntest::assert_bool(true, matches_glob("src/**/*.?pp", "src/lexer.hpp"));
+    ntest::assert_bool(true, matches_glob("src/**/*.?pp", "src/a/b/lexer.cpp"));
+    ntest::assert_bool(false, matches_glob("src/**/*.?pp", "src/a/b/lexer.c"));
+
+    std::string const json = R"([
+      { "directory": "/repo/build", "arguments": ["cc", "-c", "x.c"], "file": "../src/x.c" },
+      { "file": "/abs/y.cpp", "command": "c++ \"quoted\" y.cpp" }
+    ])";
+    std::vector<std::string> const expected { "/repo/src/x.c", "/abs/y.cpp" };
+    ntest::assert_stdvec(expected, driver::detail::parse_compile_commands(json, "/unused"));
+  }
+
+  // arena
+  {
+    util::Arena arena(1024);
+
+    void *const small = arena.allocate(3, 1);
+    void *const aligned = arena.allocate(64, 64);
+    ntest::assert_bool(true, small != aligned);
+    ntest::assert_uint64(0, reinterpret_cast<uintptr_t>(aligned) % 64);
+
+    // outgrows the first block, the next reset merges both into one
+    ntest::assert_bool(true, arena.allocate(4000, 8) != nullptr);
+    size_t const capacity = arena.capacity();
+    arena.reset();
+    ntest::assert_uint64(0, arena.bytes_used());
+    ntest::assert_uint64(capacity, arena.capacity());
+    ntest::assert_bool(true, arena.allocate(4000, 8) != nullptr);
+    ntest::assert_uint64(capacity, arena.capacity());
+
+    std::string const text = "int main() { return 0; } // done";
+    auto const tokens = lexer::tokenize_text(text.c_str(), text.length(), arena);
+    ntest::assert_stdvec(lexer::tokenize_text(text.c_str(), text.length()),
+      std::vector<lexer::Token>(tokens.begin(), tokens.end()));
+  }
+
+  // format cache
+  {
+    fs::path const dir = fs::temp_directory_path() / "fmtcpp_test_cache";
+    fs::remove_all(dir);
+    fmtcpp::FormatCache cache(dir.string());
+
+    fmtcpp::FormatOptions const options{};
+    fmtcpp::FormatOptions const wider{ .indentWidth = 2, .maxLineLen = 120 };
+    std::string const source = "int  x ;";
+    std::string const formatted = "int x;";
+
+    std::string const key = fmtcpp::FormatCache::key_of(source, options);
+    ntest::assert_uint64(32, key.length());
+    ntest::assert_bool(true, key != fmtcpp::FormatCache::key_of(source, wider));
+
+    std::string out{};
+    ntest::assert_bool(true, cache.lookup(key, out) == fmtcpp::FormatCache::Lookup::MISS);
+
+    cache.store(key, source, formatted, options);
+    ntest::assert_bool(true, cache.lookup(key, out) == fmtcpp::FormatCache::Lookup::FORMATTED);
+    ntest::assert_stdstr(formatted, out);
+    ntest::assert_bool(true,
+      cache.lookup(fmtcpp::FormatCache::key_of(formatted, options), out) == fmtcpp::FormatCache::Lookup::ALREADY_FORMATTED);
+
+    // a hit on formatted code hands nothing back
+    util::Arena scratch{};
+    std::string result{};
+    ntest::assert_bool(true, fmtcpp::format_source_code(source, options, cache, scratch, result));
+    ntest::assert_stdstr(formatted, result);
+    result.clear();
+    ntest::assert_bool(false, fmtcpp::format_source_code(formatted, options, cache, scratch, result));
+    ntest::assert_stdstr("", result);
+
+    // entry paths longer than any fixed formatting buffer mustn't run into each other
+    fs::path longDir = dir;
+    for (int i = 0; i < 6; ++i)
+      longDir /= std::string(200, static_cast<char>('a' + i));
+    fmtcpp::FormatCache deepCache(longDir.string());
+    deepCache.store(key, source, formatted, options);
+    ntest::assert_bool(true, deepCache.lookup(key, out) == fmtcpp::FormatCache::Lookup::FORMATTED);
+    ntest::assert_stdstr(formatted, out);
+
+    fs::remove_all(dir);
+  }
+
+  // parse profile
+  {
+    fmtcpp::ParseProfile profile{};
+    profile.standard = "c++20";
+    profile.includePaths = { "include" };
+    profile.defines = { "NDEBUG", "LEVEL=2" };
+
+    std::vector<std::string> const expected { "-std=c++20", "-fparse-all-comments", "-Iinclude", "-DNDEBUG", "-DLEVEL=2" };
+    ntest::assert_stdvec(expected, profile.arguments());
+    ntest::assert_uint64(CXTranslationUnit_DetailedPreprocessingRecord | CXTranslationUnit_PrecompiledPreamble, profile.flags());
+
+    fmtcpp::ParseProfile const symbols = profile.for_symbols();
+    ntest::assert_bool(true, (symbols.flags() & CXTranslationUnit_SkipFunctionBodies) != 0);
+    ntest::assert_bool(true, symbols.includePaths == profile.includePaths);
+    ntest::assert_bool(true, symbols.fingerprint() != profile.fingerprint());
+    ntest::assert_bool(true, profile.fingerprint() == fmtcpp::ParseProfile(profile).fingerprint());
+  }
+
+  // session
+  {
+    std::string const source = "#ifdef OTHER\nint other;\n#endif\nint f() { return 1; }\n";
+    auto const declares_other = [](CXTranslationUnit const transl_unit) {
+      auto const nodes = fmtcpp::index_cursors(transl_unit).nodes();
+      return std::any_of(nodes.begin(), nodes.end(), [](auto const &node) { return node.kind == CXCursor_VarDecl; });
+    };
+
+    fmtcpp::Session session{};
+    CXTranslationUnit first = nullptr;
+    CXTranslationUnit second = nullptr;
+    ntest::assert_bool(true, session.parse("session.cpp", source, first) == CXError_Success);
+    ntest::assert_bool(true, session.parse("session.cpp", source, second) == CXError_Success);
+    // reparsed in place
+    ntest::assert_bool(true, first == second);
+    ntest::assert_uint64(1, session.num_cached());
+    ntest::assert_bool(false, declares_other(second));
+
+    // another profile parses from scratch, with its own arguments
+    fmtcpp::ParseProfile other = session.profile();
+    other.defines = { "OTHER" };
+    CXTranslationUnit third = nullptr;
+    ntest::assert_bool(true, session.parse("session.cpp", source, other, third) == CXError_Success);
+    ntest::assert_uint64(1, session.num_cached());
+    ntest::assert_bool(true, declares_other(third));
+
+    session.evict("session.cpp");
+    ntest::assert_uint64(0, session.num_cached());
+
+    // nothing is kept of a parse which fails
+    fmtcpp::ParseProfile invalid = session.profile();
+    invalid.standard = "c++bogus";
+    CXTranslationUnit failed = nullptr;
+    ntest::assert_bool(true, session.parse("session.cpp", source, invalid, failed) != CXError_Success);
+    ntest::assert_uint64(0, session.num_cached());
+  }
+
+  // node dump
+  {
+    fmtcpp::NodeDumpWriter writer(0);
+    writer.add(0, "StructDecl", "test_files/ex1/math1.hpp", 11, 12, "Point2D");
+    writer.add(1, "FieldDecl", "test_files/ex1/math1.hpp", 11, 26, "x");
+    writer.add(0, "MacroExpansion", "", 0, 0, "PI");
+    std::string const dump = writer.finish();
+
+    std::ostringstream text{};
+    ntest::assert_bool(true, fmtcpp::write_dump_as_text(dump, text));
+    ntest::assert_stdstr(
+      "clang_parseTranslationUnit2 CXErrorCode = 0\n"
+      "test_files/ex1/math1.hpp:11,12   StructDecl   Point2D\n"
+      "test_files/ex1/math1.hpp:11,26   FieldDecl   x\n"
+      "MacroExpansion   PI\n",
+      text.str());
+
+    fmtcpp::NodeDumpReader reader{};
+    fmtcpp::DumpedNode node{};
+    ntest::assert_bool(true, reader.open(dump));
+    ntest::assert_uint64(3, reader.num_nodes());
+    ntest::assert_bool(true, reader.next(node) && reader.next(node));
+    ntest::assert_uint64(1, node.depth);
+
+    // cut off in the middle of a node
+    std::ostringstream partial{};
+    ntest::assert_bool(false, fmtcpp::write_dump_as_text(dump.substr(0, dump.length() - 2), partial));
+  }
+  {
+    auto const dump_as_text = [](fmtcpp::Session &session, std::string const &path, std::string_view const source) {
+      std::ostringstream dump{};
+      fmtcpp::dump_nodes(session, path, source, dump);
+      std::ostringstream text{};
+      ntest::assert_bool(true, fmtcpp::write_dump_as_text(dump.str(), text));
+      return text.str();
+    };
+
+    // the binary form reads back as what print_nodes wrote at the start
+    for (char const *const name : { "test_files/ex1/math1", "test_files/ex1/math2" }) {
+      util::MappedFile const source_code((std::string(name) + ".hpp").c_str());
+      util::MappedFile const nodes((std::string(name) + ".nodes").c_str());
+      fmtcpp::Session session{};
+      ntest::assert_stdstr(std::string(nodes.view()), dump_as_text(session, "unsaved.cpp", source_code.view()));
+    }
+
+    // each node one level below the one enclosing it
+    std::string const source = "namespace n {\n  struct S {\n    int f() { return 1; }\n  };\n}\n";
+    fmtcpp::Session session{};
+    std::ostringstream dump{};
+    fmtcpp::dump_nodes(session, "nested.cpp", source, dump);
+    std::string const bytes = dump.str();
+
+    fmtcpp::NodeDumpReader reader{};
+    fmtcpp::DumpedNode node{};
+    std::string depths{};
+    ntest::assert_bool(true, reader.open(bytes));
+    while (reader.next(node)) {
+      // leaves out the predefined macros
+      if (node.file == "nested.cpp")
+        depths += std::to_string(node.depth) + ' ' + std::string(node.kind) + ' ' + std::string(node.spelling) + '\n';
+    }
+    ntest::assert_bool(false, reader.is_corrupt());
+    ntest::assert_stdstr(
+      "0 Namespace n\n"
+      "1 StructDecl S\n"
+      "2 CXXMethod f\n"
+      "3 CompoundStmt \n"
+      "4 ReturnStmt \n"
+      "5 IntegerLiteral \n",
+      depths);
+
+    std::ostringstream printed{};
+    fmtcpp::print_nodes(session, "nested.cpp", source, printed);
+    ntest::assert_stdstr(printed.str(), dump_as_text(session, "nested.cpp", source));
+  }
+
+  // ambiguity
+  {
+    std::string const source =
+      "struct S { T * member; };\n"
+      "int f(int x) {\n"
+      "  a * b;\n"
+      "  int * c = &x;\n"
+      "  n::a < b > c;\n"
+      "  g(x)(y);\n"
+      "  g(x);\n"
+      "  FOO(x)\n"
+      "  return x;\n"
+      "}\n"
+      "int h() {\n"
+      "#define ONE 1\n"
+      "  return ONE * 2;\n"
+      "}\n";
+
+    std::vector<fmtcpp::AmbiguousSpan> spans = fmtcpp::find_ambiguous_spans(source);
+    std::vector<std::string> found{};
+    for (auto const &span : spans)
+      found.push_back(std::string(fmtcpp::ambiguity_name(span.ambiguity)) + " " + source.substr(span.begin, span.end - span.begin));
+    ntest::assert_stdvec(std::vector<std::string>{
+      "MULTIPLY_OR_DECLARE a * b",
+      "TEMPLATE_OR_COMPARE n::a < b > c",
+      "CALL_OR_DECLARE g(x)(y)",
+      "MACRO_CALL FOO(x)",
+    }, found);
+
+    // h has nothing ambiguous, only its directive is left
+    size_t numBlanked;
+    std::string const skeleton = fmtcpp::detail::blank_unambiguous_bodies(source, spans, numBlanked);
+    ntest::assert_uint64(source.length(), skeleton.length());
+    ntest::assert_uint64(std::string("  return ONE * 2;").length(), numBlanked);
+    ntest::assert_stdstr(source.substr(0, source.find("int h")), skeleton.substr(0, source.find("int h")));
+    ntest::assert_stdstr("int h() {\n#define ONE 1\n                 \n}\n", skeleton.substr(source.find("int h")));
+
+    fmtcpp::Session session{};
+    ntest::assert_uint64(source.length() - numBlanked, fmtcpp::resolve_ambiguities(session, "ambiguity.cpp", source, spans));
+    ntest::assert_uint64(0, session.num_cached());
+
+    std::vector<fmtcpp::AmbiguousSpan> none = fmtcpp::find_ambiguous_spans("int f() { return 1; }");
+    ntest::assert_uint64(0, none.size());
+    ntest::assert_uint64(0, fmtcpp::resolve_ambiguities(session, "none.cpp", "int f() { return 1; }", none));
+
+    // what the names were declared as decides
+    auto const resolve = [&](std::string const &declarations, std::string const &statement) {
+      std::string const code = declarations + "\nvoid f() {\n  " + statement + "\n}\n";
+      std::vector<fmtcpp::AmbiguousSpan> resolved = fmtcpp::find_ambiguous_spans(code);
+      fmtcpp::resolve_ambiguities(session, "readings.cpp", code, resolved);
+      std::vector<std::string> readings{};
+      for (auto const &span : resolved)
+        readings.push_back(std::string(fmtcpp::reading_name(span.reading)) + " " + code.substr(span.begin, span.end - span.begin));
+      return readings;
+    };
+    ntest::assert_stdvec(std::vector<std::string>{ "DECLARATION a * b" }, resolve("typedef int a;", "a * b;"));
+    ntest::assert_stdvec(std::vector<std::string>{ "EXPRESSION a * b" }, resolve("int a, b;", "a * b;"));
+    ntest::assert_stdvec(std::vector<std::string>{ "MACRO FOO(x)" }, resolve("#define FOO(x)", "FOO(x)"));
+  }
+
+  // cursor index
+  {
+    using Node = fmtcpp::CursorIndex::Node;
+    uint32_t const NONE = fmtcpp::CursorIndex::NONE;
+
+    std::string const source = "int f() { return a + b; }";
+    fmtcpp::CursorIndex const index({
+      Node{ 0, 25, CXCursor_FunctionDecl, NONE },
+      Node{ 8, 25, CXCursor_CompoundStmt, 0 },
+      Node{ 10, 23, CXCursor_ReturnStmt, 1 },
+      Node{ 17, 22, CXCursor_BinaryOperator, 2 },
+      Node{ 17, 18, CXCursor_DeclRefExpr, 3 },
+      Node{ 21, 30, CXCursor_DeclRefExpr, 3 }, // sticks out of its parent, e.g. through a macro
+    });
+
+    ntest::assert_uint64(22, index.node(5).end);
+    ntest::assert_uint64(0, index.innermost_at(0));
+    ntest::assert_uint64(1, index.innermost_at(9));
+    ntest::assert_uint64(4, index.innermost_at(17));
+    ntest::assert_uint64(3, index.innermost_at(19));
+    ntest::assert_uint64(5, index.innermost_at(21));
+    ntest::assert_uint64(2, index.innermost_at(22));
+    ntest::assert_uint64(1, index.innermost_at(24));
+    ntest::assert_uint64(NONE, index.innermost_at(25));
+    ntest::assert_uint64(1, index.enclosing(21, CXCursor_CompoundStmt));
+    ntest::assert_uint64(NONE, index.enclosing(21, CXCursor_CallExpr));
+
+    auto const tokens = lexer::tokenize_text(source.c_str(), source.length());
+    std::vector<uint32_t> expected{};
+    for (auto const &tok : tokens)
+      expected.push_back(index.innermost_at(tok.position()));
+    ntest::assert_stdvec(expected, index.map_tokens(tokens));
+
+    ntest::assert_uint64(NONE, fmtcpp::CursorIndex{}.innermost_at(0));
+  }
+
+  // server
+  {
+    server::Request request{};
+    size_t sourceLen = 0;
+    ntest::assert_bool(true, server::detail::parse_request_line("EDITS 12 dir/a file.cpp", request, sourceLen));
+    ntest::assert_bool(true, request.kind == server::RequestKind::EDITS);
+    ntest::assert_uint64(12, sourceLen);
+    ntest::assert_stdstr("dir/a file.cpp", request.path);
+    ntest::assert_bool(false, server::detail::parse_request_line("FORMAT 12", request, sourceLen));
+    ntest::assert_bool(false, server::detail::parse_request_line("FORMAT x a.cpp", request, sourceLen));
+    ntest::assert_bool(false, server::detail::parse_request_line("PRINT 1 a.cpp", request, sourceLen));
+
+    std::string out{};
+    server::detail::append_response(out, { server::ResponseStatus::CHANGED, "int x;" });
+    server::detail::append_response(out, { server::ResponseStatus::UNCHANGED, "" });
+    ntest::assert_stdstr("CHANGED 6\nint x;UNCHANGED 0\n", out);
+
+    // responses come back in request order, whichever worker serves them
+    server::Options options{};
+    options.numThreads = 2;
+    server::Service service(options);
+
+    std::vector<server::Request> batch{};
+    for (size_t i = 0; i < 16; ++i) {
+      auto const kind = i % 3 == 0 ? server::RequestKind::FORMAT
+        : i % 3 == 1 ? server::RequestKind::CHECK : server::RequestKind::EDITS;
+      batch.push_back({ kind, "f.cpp", i % 2 == 0 ? "int  x ;" : "int x;\n" });
+    }
+
+    auto const responses = service.handle(batch);
+    ntest::assert_uint64(batch.size(), responses.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      bool const isFormatted = i % 2 == 1;
+      ntest::assert_bool(true,
+        responses[i].status == (isFormatted ? server::ResponseStatus::UNCHANGED : server::ResponseStatus::CHANGED));
+      if (batch[i].kind == server::RequestKind::FORMAT)
+        ntest::assert_stdstr(isFormatted ? "" : "int x;\n", responses[i].payload);
+      if (batch[i].kind == server::RequestKind::EDITS) {
+        std::string expectedEdits{};
+        for (auto const &edit : fmtcpp::format_edits(batch[i].source))
+          expectedEdits += fmtcpp::describe_edit(edit) + "\n";
+        ntest::assert_stdstr(expectedEdits, responses[i].payload);
+      }
+    }
+  }
+
+  // symbol table
+  {
+    using fmtcpp::SymbolKind;
+
+    fmtcpp::SymbolTable table{};
+    table.add("math1::types::Point2D", SymbolKind::STRUCT);
+    table.add("Point2D", SymbolKind::FUNCTION);
+    ntest::assert_bool(true, table.lookup("math1::types::Point2D") == SymbolKind::STRUCT);
+    ntest::assert_bool(true, table.lookup("Point2D") == SymbolKind::STRUCT);
+    ntest::assert_bool(true, table.lookup("types") == SymbolKind::NONE);
+
+    fmtcpp::HeaderSymbols const header{
+      "/repo/test_files/ex1/math1.hpp", 1234567,
+      { { "PI", SymbolKind::MACRO }, { "math1::add", SymbolKind::FUNCTION } },
+    };
+    std::string const bytes = fmtcpp::detail::encode_header_symbols(header);
+    fmtcpp::HeaderSymbols decoded{};
+    ntest::assert_bool(true, fmtcpp::detail::decode_header_symbols(bytes, decoded));
+    ntest::assert_stdstr(header.path, decoded.path);
+    ntest::assert_bool(true, header.mtime == decoded.mtime && header.symbols == decoded.symbols);
+    ntest::assert_bool(false, fmtcpp::detail::decode_header_symbols(bytes.substr(0, bytes.length() - 1), decoded));
+
+    // a file's own macros are known without parsing anything
+    fs::path const dir = fs::temp_directory_path() / "fmtcpp_test_symbols";
+    fs::remove_all(dir);
+    fmtcpp::SymbolIndex index(dir.string());
+    fmtcpp::Session session{};
+    fmtcpp::SymbolTable const symbols =
+      index.symbols_for(session, "test_files/ex1/unsaved.cpp", "#define ANSWER 42\nint x = ANSWER;\n");
+    ntest::assert_bool(true, symbols.lookup("ANSWER") == SymbolKind::MACRO);
+
+    // an included header is parsed once, then served from the index until its mtime changes
+    // a missing directory (nothing was indexed) has no entries
+    std::error_code err{};
+    auto const entry_times = [&] {
+      std::vector<std::pair<std::string, fs::file_time_type>> times{};
+      for (auto const &entry : fs::recursive_directory_iterator(dir, err))
+        times.emplace_back(entry.path().string(), entry.last_write_time());
+      std::sort(times.begin(), times.end());
+      return times;
+    };
+    auto const indexed_mtime = [&](std::string_view const name) {
+      for (auto const &entry : fs::recursive_directory_iterator(dir, err)) {
+        fmtcpp::HeaderSymbols indexed{};
+        auto const stored = util::read_entry(entry.path().string());
+        if (entry.path().extension() == ".hdr" && stored && fmtcpp::detail::decode_header_symbols(stored->view(), indexed) &&
+            indexed.path.ends_with(name))
+          return indexed.mtime;
+      }
+      return int64_t(-1);
+    };
+
+    fs::path const math1 = "test_files/ex1/math1.hpp";
+    std::string const includer = "test_files/ex1/includer.cpp";
+    std::string const includes = "#include \"math1.hpp\"\n";
+    auto const mtime = fs::last_write_time(math1);
+
+    ntest::assert_bool(true, index.symbols_for(session, includer, includes).lookup("Point2D") == SymbolKind::STRUCT);
+    ntest::assert_bool(true, indexed_mtime("/math1.hpp") == mtime.time_since_epoch().count());
+
+    // entries pinned to a day ago would show any rewrite
+    for (auto const &entry : fs::recursive_directory_iterator(dir, err)) {
+      if (entry.is_regular_file())
+        fs::last_write_time(entry.path(), fs::file_time_type::clock::now() - std::chrono::hours(24));
+    }
+    auto const pinned = entry_times();
+    ntest::assert_bool(true, index.symbols_for(session, includer, includes).lookup("Point2D") == SymbolKind::STRUCT);
+    ntest::assert_bool(true, pinned == entry_times());
+
+    fs::last_write_time(math1, mtime + std::chrono::seconds(10));
+    ntest::assert_bool(true, index.symbols_for(session, includer, includes).lookup("Point2D") == SymbolKind::STRUCT);
+    ntest::assert_bool(true, indexed_mtime("/math1.hpp") == (mtime + std::chrono::seconds(10)).time_since_epoch().count());
+    fs::last_write_time(math1, mtime);
+
+    fs::remove_all(dir);
+  }
+
+  // formatter
+  {
+    fmtcpp::FormatOptions const options{ .indentWidth = 2, .maxLineLen = 40 };
+
+    std::string const source =
+      "int  main( ) {\n"
+      "if (x)\n"
+      "foo(a,b) ;   // trailing\n"
+      "\n\n\n"
+      "   return call(first_argument, second_argument, third);\n"
+      "}";
+    std::string const expected =
+      "int main() {\n"
+      "  if (x)\n"
+      "    foo(a, b);   // trailing\n"
+      "\n"
+      "  return call(first_argument,\n"
+      "      second_argument, third);\n"
+      "}\n";
+    ntest::assert_stdstr(expected, fmtcpp::format_source_code(source, options));
+
+    // line endings are kept, directives and comments spanning lines keep their indentation
+    std::string const crlf = "  #define A \\\r\n    1\r\nstruct S {\r\n    /* a\r\n     b */\r\nint x;\r\n};";
+    std::string const crlfExpected = "  #define A \\\r\n    1\r\nstruct S {\r\n    /* a\r\n     b */\r\n  int x;\r\n};\r\n";
+    ntest::assert_stdstr(crlfExpected, fmtcpp::format_source_code(crlf, options));
+    std::string const cr = "struct S {\rint x;\r\r\r  int y; };";
+    ntest::assert_stdstr("struct S {\r  int x;\r\r  int y; };\r", fmtcpp::format_source_code(cr, options));
+
+    {
+      // only the selected line changes, only the declaration around it is looked at
+      std::string const file =
+        "int a( ) ;\n"
+        "void f() {\n"
+        "return  1;\n"
+        "}\n"
+        "void g() {\n"
+        "return  2;\n"
+        "}\n";
+      size_t const selected = file.find("return  2");
+
+      fmtcpp::BoundaryIndex const boundaries(file);
+      ntest::assert_uint64(file.find("void g"), boundaries.before(selected));
+      ntest::assert_uint64(file.length(), boundaries.after(selected));
+
+      std::vector<fmtcpp::Edit> const edits = fmtcpp::format_range(file, selected, selected + 10, options);
+      std::string edited = file;
+      for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+        edited.replace(edit->offset, edit->length, edit->replacement);
+
+      ntest::assert_uint64(2, edits.size());
+      ntest::assert_stdstr(
+        "int a( ) ;\nvoid f() {\nreturn  1;\n}\nvoid g() {\n  return 2;\n}\n", edited);
+    }
+
+    {
+      // statements in column 0 inside a body are no boundaries, ranges format like the whole file
+      std::string const file =
+        "int a;\n"
+        "struct S {\n"
+        "  int x;\n"
+        "int y;\n"
+        "};\n"
+        "int f() {\n"
+        "  int b = 1;\n"
+        "return  2;\n"
+        "}\n";
+
+      fmtcpp::BoundaryIndex const boundaries(file);
+      ntest::assert_uint64(file.find("int f"), boundaries.before(file.find("return")));
+      ntest::assert_uint64(file.find("int f"), boundaries.after(file.find("int y")));
+
+      std::string edited = file;
+      for (std::string_view const line : { "return  2;", "int y;" }) {
+        size_t const selected = edited.find(line);
+        std::vector<fmtcpp::Edit> const edits = fmtcpp::format_range(edited, selected, selected + line.length(), options);
+        for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+          edited.replace(edit->offset, edit->length, edit->replacement);
+      }
+      ntest::assert_stdstr(fmtcpp::format_source_code(file, options), edited);
+    }
+
+    {
+      // declarations inside namespaces are boundaries too, indented as inside of them
+      std::string const file =
+        "namespace a {\n"
+        "extern \"C\" {\n"
+        "int g( );\n"
+        "}\n"
+        "int f() {\n"
+        "return  2;\n"
+        "}\n"
+        "}\n";
+      size_t const selected = file.find("return");
+
+      fmtcpp::BoundaryIndex boundaries(file);
+      ntest::assert_uint64(file.find("int f"), boundaries.before(selected));
+      ntest::assert_uint64(file.length(), boundaries.after(selected));
+      std::vector<size_t> const enclosing { 0 };
+      ntest::assert_stdvec(enclosing, boundaries.enclosing(file.find("int f")));
+
+      std::vector<fmtcpp::Edit> const edits = fmtcpp::format_range(file, boundaries, selected, selected + 6, options);
+      std::string edited = file;
+      for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+        edited.replace(edit->offset, edit->length, edit->replacement);
+      ntest::assert_stdstr(
+        "namespace a {\nextern \"C\" {\nint g( );\n}\nint f() {\n    return 2;\n}\n}\n", edited);
+
+      // after an edit only the part around it is lexed again, the index ends up as if built anew
+      boundaries.update(edited, 0, file.length(), edited.length());
+      std::string changed = edited;
+      changed.insert(changed.find("int g"), "void h();\n");
+      boundaries.update(changed, changed.find("void h"), 0, 10);
+      fmtcpp::BoundaryIndex const rebuilt(changed);
+      for (size_t pos = 0; pos <= changed.length(); ++pos) {
+        ntest::assert_uint64(rebuilt.before(pos), boundaries.before(pos));
+        ntest::assert_uint64(rebuilt.after(pos), boundaries.after(pos));
+      }
+      std::vector<size_t> const linkage { 0, file.find("extern") };
+      ntest::assert_stdvec(linkage, boundaries.enclosing(changed.find("int g")));
+    }
+
+    {
+      // applying the edits gives the formatted output
+      std::vector<fmtcpp::Edit> const edits = fmtcpp::format_edits(source, options);
+      std::string edited = source;
+      for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+        edited.replace(edit->offset, edit->length, edit->replacement);
+      ntest::assert_stdstr(expected, edited);
+
+      util::Arena scratch{};
+      ntest::assert_bool(false, fmtcpp::is_formatted(source, options, scratch));
+      ntest::assert_bool(true, fmtcpp::is_formatted(expected, options, scratch));
+    }
+
+    // formatting formatted code changes nothing
+    for (char const *const path : {
+      "test_files/tiny/main.c",
+      "test_files/tiny/prepro.c",
+      "test_files/ex1/math1.hpp",
+      "src/lexer.cpp",
+    }) {
+      std::string const formatted = fmtcpp::format_source_code(util::extract_txt_file_contents(path), options);
+      ntest::assert_stdstr(formatted, fmtcpp::format_source_code(formatted, options));
+      ntest::assert_uint64(0, fmtcpp::format_edits(formatted, options).size());
+    }
+  }
+
+  // scan
+  {
+    // long enough to exercise full 16/32 byte blocks as well as the scalar tails
+    std::string const whitespace = std::string(37, ' ') + "\t\v\f";
+    std::string const identifier = "_identifier_0123456789_abcdefghijklmnopqrstuvwxyz_ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string const comment = " /* comment \xE2\x80\x94 spanning\nlines */";
+    std::string const text = whitespace + identifier + comment;
+
+    for (auto const isa : { scan::Isa::SCALAR, scan::Isa::SSE2, scan::Isa::AVX2 }) {
+      scan::force_isa(isa);
+
+      ntest::assert_uint64(whitespace.length(), scan::count_whitespace(text.c_str(), text.length()));
+      ntest::assert_uint64(0, scan::count_whitespace(identifier.c_str(), identifier.length()));
+      ntest::assert_uint64(identifier.length(), scan::count_identifier_chars(identifier.c_str(), identifier.length()));
+      ntest::assert_uint64(0, scan::count_identifier_chars(comment.c_str(), comment.length()));
+      ntest::assert_uint64(text.find('\n'), scan::find_char(text.c_str(), text.length(), '\n'));
+      ntest::assert_uint64(text.length(), scan::find_char(text.c_str(), text.length(), '@'));
+      ntest::assert_uint64(text.find_first_of("*\n"), scan::find_either_char(text.c_str(), text.length(), '\n', '*'));
+    }
+
+    scan::force_isa(scan::Isa::AVX2); // i.e. the best supported
+  }
+
+  // lexer
   {
     using lexer::TokenType;
     using lexer::Token;
@@ -170,8 +796,203 @@ int main() {
       std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
       ntest::assert_stdvec(expected, actual);
     }
+    {
+      std::vector<lexer::Token> const expected {
+        Token(TokenType::IDENTIFIER,                 0, 1),
+        Token(TokenType::OPER_ASSIGN_BITSHIFTLEFT,   2, 3),
+        Token(TokenType::IDENTIFIER,                 6, 1),
+        Token(TokenType::OPER_ARROW,                 7, 2),
+        Token(TokenType::IDENTIFIER,                 9, 1),
+        Token(TokenType::SPECIAL_ELLIPSES,          11, 3),
+        Token(TokenType::IDENTIFIER,                15, 1),
+        Token(TokenType::OPER_ASSIGN_BITSHIFTRIGHT, 17, 3),
+        Token(TokenType::IDENTIFIER,                21, 1),
+        Token(TokenType::OPER_LOGIC_AND,            23, 2),
+        Token(TokenType::IDENTIFIER,                26, 1),
+        Token(TokenType::OPER_REL_NOTEQ,            28, 2),
+        Token(TokenType::KEYWORD_BOOL,              31, 5),
+        Token(TokenType::SPECIAL_SEMICOLON,         36, 1),
+        Token(TokenType::NEWLINE,                   37, 1),
+      };
+      std::string const text = "a <<= b->c ... x >>= y && z != _Bool;\n";
+      std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
+      ntest::assert_stdvec(expected, actual);
+    }
+    {
+      std::vector<lexer::Token> const expected {
+        Token(TokenType::KEYWORD_AUTO,       0,  4),
+        Token(TokenType::IDENTIFIER,         5,  1),
+        Token(TokenType::OPER_ASSIGN,        7,  1),
+        Token(TokenType::LITERAL_STR,        9,  5), // u8"a"
+        Token(TokenType::LITERAL_STR,       15, 10), // LR"x(q")x"
+        Token(TokenType::LITERAL_STR,       26,  6), // R"(\)"
+        Token(TokenType::LITERAL_CHAR,      33,  5), // 'c'_u
+        Token(TokenType::LITERAL_NUM,       39,  5), // 10_km
+        Token(TokenType::LITERAL_STR,       45,  5), // L"w"s
+        Token(TokenType::LITERAL_CHAR,      51,  5), // u8'x'
+        Token(TokenType::IDENTIFIER,        57,  1), // R
+        Token(TokenType::IDENTIFIER,        59,  1), // x
+        Token(TokenType::LITERAL_STR,       60,  3), // "y"
+        Token(TokenType::SPECIAL_SEMICOLON, 63,  1),
+        Token(TokenType::NEWLINE,           64,  1),
+      };
+      std::string const text = R"txt(auto s = u8"a" LR"x(q")x" R"(\)" 'c'_u 10_km L"w"s u8'x' R x"y";)txt" "\n";
+      std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
+      ntest::assert_stdvec(expected, actual);
+    }
+    {
+      // directive without a trailing newline
+      std::vector<lexer::Token> const expected {
+        Token(TokenType::PREPRO_DIR_DEFINE, 0, 31),
+      };
+      std::string const text = "#define S \"a\\\"b\" /* x */ \\\n + 1";
+      std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
+      ntest::assert_stdvec(expected, actual);
+    }
+    {
+      // a comment ending in two backslashes still continues on the next line
+      std::vector<lexer::Token> const expected {
+        Token(TokenType::COMMENT_SINGLELINE, 0, 9),
+        Token(TokenType::NEWLINE,            9, 1),
+        Token(TokenType::IDENTIFIER,         10, 1),
+      };
+      std::string const text = "// a \\\\\nb\nx";
+      std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
+      ntest::assert_stdvec(expected, actual);
+    }
+    {
+      // streaming in chunks of any size must produce the same tokens
+      std::string text{};
+      for (auto const path : {
+        "test_files/tiny/prepro.c",
+        "test_files/tiny/char_literals.c",
+        "test_files/tiny/string_literals.c",
+        "test_files/ex1/math1.hpp",
+      }) {
+        text += util::extract_txt_file_contents(path);
+      }
+      text += "// " + std::string(300, '-') + "\n";
+      text += R"txt(auto s = LR"delimiter(q")delimiter" /* unclosed comment)txt";
+
+      std::vector<lexer::Token> const expected = lexer::tokenize_text(text.c_str(), text.length());
+
+      for (size_t const chunkLen : { 1ull, 7ull, 4096ull }) {
+        lexer::TokenStream stream{};
+        std::vector<lexer::Token> actual{};
+
+        for (size_t chunkPos = 0; chunkPos < text.length(); chunkPos += chunkLen) {
+          stream.feed(text.c_str() + chunkPos, std::min(chunkLen, text.length() - chunkPos));
+          for (Token tok(TokenType::NIL, 0, 0); stream.next(tok);)
+            actual.push_back(tok);
+        }
+        stream.finish();
+        for (Token tok(TokenType::NIL, 0, 0); stream.next(tok);)
+          actual.push_back(tok);
+
+        ntest::assert_bool(true, stream.done());
+        ntest::assert_stdvec(expected, actual);
+      }
+
+      // the compact storage must give back every token, including those too long for its length byte
+      lexer::TokenBuffer buffer{};
+      lexer::tokenize_text(text.c_str(), text.length(), buffer);
+      ntest::assert_stdvec(expected, buffer.to_vector());
+    }
+    {
+      // relexing after an edit must produce the same tokens as lexing the edited text
+      std::string text = util::extract_txt_file_contents("test_files/tiny/prepro.c");
+      text += util::extract_txt_file_contents("test_files/ex1/math1.hpp");
+      std::vector<Token> tokens = lexer::tokenize_text(text.c_str(), text.length());
+
+      // opening and closing comments and literals, unknown characters, plain typing...
+      char const *const insertions[] { "/*", "*/", "\"", "R\"x(", ")x\"", "@", "x", "\n", "", "  y = 1;\n" };
+      uint64_t state = 42;
+      for (size_t i = 0; i < 300; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        size_t const offset = (state >> 33) % (text.length() + 1);
+        size_t const removedLen = std::min<size_t>((state >> 13) % 4, text.length() - offset);
+        std::string_view const inserted = insertions[(state >> 20) % std::size(insertions)];
+
+        text.replace(offset, removedLen, inserted);
+        auto const result = lexer::relex(tokens, text.c_str(), text.length(), offset, removedLen, inserted.length());
+
+        ntest::assert_stdvec(lexer::tokenize_text(text.c_str(), text.length()), tokens);
+        ntest::assert_bool(true, result.first + result.numInserted <= tokens.size());
+      }
+    }
+    {
+      // directives are indexed in the same pass
+      std::string const text =
+        "#include <vector>\n"
+        "#ifdef A\n"
+        "#  define B(x) x\n"
+        "#if B(1)\n"
+        "int a;\n"
+        "#elif 0\n"
+        "int b;\n"
+        "#else\n"
+        "#endif\n"
+        "#endif\n"
+        "#include \"local.h\"\n"
+        "#ifndef C\n"
+        "int c;\n";
+      auto const pos = [&](char const *const needle) { return static_cast<uint32_t>(text.find(needle)); };
+
+      lexer::PreproIndex prepro{};
+      ntest::assert_stdvec(lexer::tokenize_text(text.c_str(), text.length()),
+        lexer::tokenize_text(text.c_str(), text.length(), prepro));
+
+      auto const &conditionals = prepro.conditionals();
+      ntest::assert_uint64(3, conditionals.size());
+      ntest::assert_uint64(pos("#ifdef A"), conditionals[0].begin);
+      ntest::assert_uint64(pos("#include \"") - 1, conditionals[0].end);
+      ntest::assert_uint64(0, conditionals[1].parent);
+      ntest::assert_stdvec(std::vector<uint32_t>{ pos("#elif"), pos("#else"), pos("#endif") }, conditionals[1].branches);
+      ntest::assert_uint64(text.length(), conditionals[2].end);
+
+      ntest::assert_uint64(1, prepro.conditional_at(pos("int b")));
+      ntest::assert_uint64(0, prepro.conditional_at(pos("#  define")));
+      ntest::assert_uint64(lexer::PreproIndex::NONE, prepro.conditional_at(pos("#include \"")));
+      ntest::assert_uint64(2, prepro.conditional_at(pos("int c")));
+      ntest::assert_uint64(pos("#else"), prepro.branch_end(1, pos("int b")));
+
+      ntest::assert_uint64(1, prepro.defines().size());
+      ntest::assert_stdstr("B", prepro.defines()[0].name);
+      ntest::assert_uint64(2, prepro.includes().size());
+      ntest::assert_stdstr("<vector>", prepro.includes()[0].path);
+      ntest::assert_stdstr("\"local.h\"", prepro.includes()[1].path);
+      ntest::assert_uint64(10, prepro.directives().size());
+    }
+    {
+      // lexing in chunks must produce the same tokens however the chunk starts were mispredicted:
+      // lines starting inside comments, raw strings and string continuations, and an unknown character
+      std::string text = util::extract_txt_file_contents("test_files/ex1/math1.hpp");
+      text += "/* a comment\nint x = 1;\n\"not a string\n*/\n";
+      text += "auto s = R\"x(\n)\" int y;\n)x\";\n";
+      text += "char const *t = \"\\\nint z;\";\n";
+      text += text;
+      text += "int w; @ int v;\n" + text;
+
+      std::vector<Token> const expected = lexer::tokenize_text(text.c_str(), text.length());
+      for (size_t numChunks = 1; numChunks <= 40; numChunks += 3)
+        ntest::assert_stdvec(expected, lexer::detail::tokenize_chunks(text.c_str(), text.length(), numChunks));
+      ntest::assert_stdvec(expected, lexer::tokenize_text_parallel(text.c_str(), text.length()));
+    }
+    {
+      // CRLF line endings, including an escaped one (line continuation)
+      std::vector<lexer::Token> const expected {
+        Token(TokenType::PREPRO_DIR_DEFINE,   0, 16),
+        Token(TokenType::NEWLINE,            16, 2),
+        Token(TokenType::COMMENT_SINGLELINE, 18, 4),
+        Token(TokenType::NEWLINE,            22, 2),
+        Token(TokenType::IDENTIFIER,         24, 1),
+        Token(TokenType::NEWLINE,            25, 1),
+      };
+      std::string const text = "#define A \\\r\n  1\r\n// c\r\nx\r";
+      std::vector<lexer::Token> const actual = lexer::tokenize_text(text.c_str(), text.length());
+      ntest::assert_stdvec(expected, actual);
+    }
   }
-  #endif // lexer
 
   // report output
   {
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+util::WorkStealingPool::WorkStealingPool(size_t numThreads) {
+  if (numThreads == 0)
+    numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  m_queues.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i)
+    m_queues.push_back(std::make_unique<WorkerQueue>());
+
+  m_threads.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; ++i)
+    m_threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+}
+
+util::WorkStealingPool::~WorkStealingPool() {
+  wait();
+
+  {
+    std::lock_guard<std::mutex> const lock(m_sleepMutex);
+    m_stopping = true;
+  }
+  m_wakeup.notify_all();
+
+  for (auto &thread : m_threads)
+    thread.join();
+}
+
+void util::WorkStealingPool::submit(task_t task) {
+  ++m_numPending;
+
+  {
+    // incremented under the sleep mutex so a worker can't miss the wakeup
+    // between checking `m_numQueued` and going to sleep. counted before the push
+    // so a worker can never take the task before it's accounted for
+    std::lock_guard<std::mutex> const lock(m_sleepMutex);
+    ++m_numQueued;
+  }
+
+  size_t const queueIdx = m_nextQueue++ % m_queues.size();
+  {
+    WorkerQueue &queue = *m_queues[queueIdx];
+    std::lock_guard<std::mutex> const lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  m_wakeup.notify_one();
+}
+
+void util::WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(m_sleepMutex);
+  m_allDone.wait(lock, [this] { return m_numPending == 0; });
+}
+
+size_t util::WorkStealingPool::num_threads() const noexcept {
+  return m_threads.size();
+}
+
+bool util::WorkStealingPool::pop_local(size_t const workerIdx, task_t &out) {
+  WorkerQueue &queue = *m_queues[workerIdx];
+  std::lock_guard<std::mutex> const lock(queue.mutex);
+
+  if (queue.tasks.empty())
+    return false;
+
+  out = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool util::WorkStealingPool::steal(size_t const thiefIdx, task_t &out) {
+  size_t const numQueues = m_queues.size();
+
+  for (size_t offset = 1; offset < numQueues; ++offset) {
+    WorkerQueue &victim = *m_queues[(thiefIdx + offset) % numQueues];
+    std::lock_guard<std::mutex> const lock(victim.mutex);
+
+    if (!victim.tasks.empty()) {
+      out = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void util::WorkStealingPool::worker_loop(size_t const workerIdx) {
+  while (true) {
+    task_t task;
+
+    if (pop_local(workerIdx, task) || steal(workerIdx, task)) {
+      --m_numQueued;
+      task(workerIdx);
+
+      if (--m_numPending == 0) {
+        std::lock_guard<std::mutex> const lock(m_sleepMutex);
+        m_allDone.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    m_wakeup.wait(lock, [this] { return m_stopping || m_numQueued > 0; });
+    if (m_stopping && m_numQueued == 0)
+      return;
+  }
+}
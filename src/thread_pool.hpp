@@ -0,0 +1,66 @@
+#ifndef FMTCPP_THREAD_POOL_HPP
+#define FMTCPP_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// Fixed-size thread pool where every worker owns a task queue. Workers take
+// tasks from the back of their own queue and, once that runs dry, steal from
+// the front of the others' queues, so uneven task sizes (e.g. a handful of
+// huge files among thousands of small ones) still keep every core busy.
+class WorkStealingPool {
+  public:
+    // Tasks are given the index of the worker running them, in [0, num_threads()),
+    // which lets callers keep per-worker state without locking.
+    typedef std::function<void (size_t workerIdx)> task_t;
+
+    // 0 means one worker per hardware thread.
+    explicit WorkStealingPool(size_t numThreads = 0);
+
+    // Finishes all submitted tasks before returning.
+    ~WorkStealingPool();
+
+    WorkStealingPool(WorkStealingPool const &) = delete;
+    WorkStealingPool &operator=(WorkStealingPool const &) = delete;
+
+    void submit(task_t task);
+
+    // Blocks until every submitted task has finished.
+    void wait();
+
+    size_t num_threads() const noexcept;
+
+  private:
+    struct WorkerQueue {
+      std::mutex mutex{};
+      std::deque<task_t> tasks{};
+    };
+
+    void worker_loop(size_t workerIdx);
+    bool pop_local(size_t workerIdx, task_t &out);
+    bool steal(size_t thiefIdx, task_t &out);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues{};
+    std::vector<std::thread> m_threads{};
+
+    std::atomic<size_t> m_nextQueue = 0;
+    std::atomic<size_t> m_numQueued = 0;  // tasks sitting in a queue
+    std::atomic<size_t> m_numPending = 0; // tasks submitted but not finished
+
+    std::mutex m_sleepMutex{};
+    std::condition_variable m_wakeup{};
+    std::condition_variable m_allDone{};
+    bool m_stopping = false;
+};
+
+} // namespace util
+
+#endif // FMTCPP_THREAD_POOL_HPP
@@ -1,10 +1,22 @@
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cstdarg>
 #include <filesystem>
 #include <iostream>
+#include <random>
 #include <utility>
 #include <cassert>
+#include <cerrno>
 
+#if !defined(_WIN32)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "scan.hpp"
 #include "term.hpp"
 #include "util.hpp"
 
@@ -49,23 +61,23 @@ void util::escape_escape_sequences(std::string &str) {
 
 size_t util::find_unescaped(
   char const *const str,
+  size_t const len,
   char const searchCh,
   char const escapeCh,
   size_t const offset
 ) {
-  size_t const len = strlen(str);
-
-  for (size_t pos = offset; pos < len; ++pos) {
-    if (str[pos] != searchCh) {
-      continue;
-    }
+  size_t pos = offset;
 
-    auto const escapeCount = std::count(str, str + pos - 1, escapeCh);
+  while (pos < len) {
+    pos += scan::find_either_char(str + pos, len - pos, searchCh, escapeCh);
 
-    bool const isEscaped = !is_even(escapeCount);
-    if (!isEscaped) {
+    if (pos >= len)
+      break;
+    else if (str[pos] == escapeCh)
+      // skip over the escape character and whatever it escapes
+      pos += 2;
+    else
       return pos;
-    }
   }
 
   return std::string::npos;
@@ -105,21 +117,236 @@ std::vector<char> util::extract_bin_file_contents(char const *const path) {
 }
 
 std::string util::extract_txt_file_contents(char const *const path) {
-  std::fstream file = util::open_file(path, std::ios::in);
-  auto const fileSize = std::filesystem::file_size(path);
+  util::MappedFile const file(path);
+  return std::string(file.view());
+}
+
+util::MappedFile::MappedFile(char const *const path) {
+  using util::make_str;
+
+#if defined(_WIN32)
+  m_readBuffer = util::extract_bin_file_contents(path);
+#else
+  int const fd = ::open(path, O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(make_str("unable to open file '%s'", path));
+
+  struct stat info;
+  if (::fstat(fd, &info) == -1) {
+    ::close(fd);
+    throw std::runtime_error(make_str("unable to stat file '%s'", path));
+  }
+
+  size_t const fileSize = static_cast<size_t>(info.st_size);
+
+  if (fileSize > 0 && S_ISREG(info.st_mode)) {
+    void *const mapping = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      ::madvise(mapping, fileSize, MADV_SEQUENTIAL);
+      m_data = static_cast<char const *>(mapping);
+      m_size = fileSize;
+      m_isMapped = true;
+      ::close(fd);
+      return;
+    }
+  }
+
+  // mmap isn't possible (empty file, not a regular file, ...), read it instead
+  m_readBuffer.resize(fileSize);
+  size_t numRead = 0;
+  while (true) {
+    if (numRead == m_readBuffer.size())
+      m_readBuffer.resize(std::max(m_readBuffer.size() * 2, size_t(4096)));
+
+    ssize_t const result = ::read(fd, m_readBuffer.data() + numRead, m_readBuffer.size() - numRead);
+    if (result == -1) {
+      if (errno == EINTR)
+        continue;
+      ::close(fd);
+      throw std::runtime_error(make_str("unable to read file '%s'", path));
+    }
+    if (result == 0)
+      break;
+    numRead += static_cast<size_t>(result);
+  }
+  m_readBuffer.resize(numRead);
+  ::close(fd);
+#endif
+
+  m_data = m_readBuffer.data();
+  m_size = m_readBuffer.size();
+}
+
+util::MappedFile::~MappedFile() {
+  release();
+}
+
+util::MappedFile::MappedFile(MappedFile &&other) noexcept {
+  *this = std::move(other);
+}
+
+util::MappedFile &util::MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    release();
+
+    m_readBuffer = std::move(other.m_readBuffer);
+    m_isMapped = other.m_isMapped;
+    m_size = other.m_size;
+    m_data = m_isMapped ? other.m_data : m_readBuffer.data();
+
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_isMapped = false;
+  }
+  return *this;
+}
+
+void util::MappedFile::release() noexcept {
+#if !defined(_WIN32)
+  if (m_isMapped)
+    ::munmap(const_cast<char *>(m_data), m_size);
+#endif
+  m_data = nullptr;
+  m_size = 0;
+  m_isMapped = false;
+  m_readBuffer.clear();
+}
+
+char const *util::MappedFile::data() const noexcept { return m_data; }
+size_t util::MappedFile::size() const noexcept { return m_size; }
+std::string_view util::MappedFile::view() const noexcept { return { m_data, m_size }; }
+bool util::MappedFile::is_mapped() const noexcept { return m_isMapped; }
+
+std::optional<util::MappedFile> util::read_entry(std::string const &path) {
+  std::error_code err{};
+  if (!std::filesystem::exists(path, err))
+    return std::nullopt;
+
+  try {
+    return std::optional<MappedFile>(std::in_place, path.c_str());
+  } catch (...) {
+    return std::nullopt;
+  }
+}
+
+void util::write_entry(std::string const &path, std::string_view const bytes) {
+  std::error_code err{};
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path(), err);
+  util::write_file_atomically(path, bytes);
+}
+
+void util::write_file_atomically(std::string const &path, std::string_view const content) {
+  using util::make_str;
+
+  // unique per process and call, so concurrent writers never share a temporary file
+  static unsigned long long const s_processNonce = std::random_device{}();
+  static std::atomic<unsigned long long> s_counter = 0;
+  // make_str cuts long strings short, only the suffix goes through it
+  std::string const tmpPath = path + make_str(".fmtcpp-tmp-%llx-%llu", s_processNonce, s_counter++);
+
+  {
+    std::ofstream tmp(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!tmp.is_open())
+      throw std::runtime_error(make_str("unable to create file '%s'", tmpPath.c_str()));
+
+    tmp.write(content.data(), static_cast<std::streamsize>(content.length()));
+    tmp.close();
+
+    if (!tmp) {
+      std::filesystem::remove(tmpPath);
+      throw std::runtime_error(make_str("unable to write file '%s'", tmpPath.c_str()));
+    }
+  }
+
+  std::error_code ec;
+  auto const originalStatus = std::filesystem::status(path, ec);
+  if (!ec && std::filesystem::exists(originalStatus))
+    std::filesystem::permissions(tmpPath, originalStatus.permissions(), ec);
+
+  std::filesystem::rename(tmpPath, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmpPath);
+    throw std::runtime_error(make_str("unable to replace '%s': %s", path.c_str(), ec.message().c_str()));
+  }
+}
+
+uint64_t util::hash_bytes(std::string_view const bytes, uint64_t const seed) noexcept {
+  // MurmurHash64A
+  uint64_t const m = 0xC6A4A7935BD1E995ull;
+  int const r = 47;
 
-  std::string content{};
-  content.reserve(fileSize);
+  size_t const len = bytes.length();
+  uint64_t hash = seed ^ (len * m);
 
-  std::getline(file, content, '\0');
+  char const *data = bytes.data();
+  char const *const blocksEnd = data + (len / 8) * 8;
 
-  // remove any \r characters
-  content.erase(
-    remove(content.begin(), content.end(), '\r'),
-    content.end()
-  );
+  for (; data != blocksEnd; data += 8) {
+    uint64_t block;
+    std::memcpy(&block, data, sizeof(block));
 
-  return content;
+    block *= m;
+    block ^= block >> r;
+    block *= m;
+
+    hash ^= block;
+    hash *= m;
+  }
+
+  size_t const tailLen = len & 7;
+  for (size_t i = tailLen; i > 0; --i)
+    hash ^= uint64_t(static_cast<uint8_t>(data[i - 1])) << (8 * (i - 1));
+  if (tailLen > 0)
+    hash *= m;
+
+  hash ^= hash >> r;
+  hash *= m;
+  hash ^= hash >> r;
+
+  return hash;
+}
+
+std::string util::content_key(std::string_view const bytes, uint64_t const seed) {
+  // two differently seeded halves make collisions practically impossible
+  uint64_t const lo = util::hash_bytes(bytes, seed);
+  uint64_t const hi = util::hash_bytes(bytes, ~seed ^ lo);
+
+  return util::make_str("%016llx%016llx",
+    static_cast<unsigned long long>(hi),
+    static_cast<unsigned long long>(lo));
+}
+
+std::string util::sharded_entry_path(std::string const &directory, std::string const &key, char const *const extension) {
+  std::string path = directory;
+  path += '/';
+  path.append(key, 0, 2);
+  path += '/';
+  path += key;
+  path += extension;
+  return path;
+}
+
+void util::append_varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+bool util::read_varint(std::string_view const bytes, size_t &pos, uint64_t &value) noexcept {
+  uint64_t result = 0;
+  // a uint64_t takes at most 10 bytes
+  for (size_t i = 0; i < 10 && pos + i < bytes.length(); ++i) {
+    uint8_t const byte = static_cast<uint8_t>(bytes[pos + i]);
+    result |= uint64_t(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      pos += i + 1;
+      value = result;
+      return true;
+    }
+  }
+  return false;
 }
 
 std::string util::make_str(char const *const fmt, ...)
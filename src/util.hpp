@@ -3,8 +3,11 @@
 #ifndef FMTCPP_UTIL_HPP
 #define FMTCPP_UTIL_HPP
 
+#include <cstdint>
 #include <fstream>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace util {
@@ -19,17 +22,78 @@ bool is_non_newline_whitespace(char);
 
 void escape_escape_sequences(std::string &);
 
+// Returns the position of the first `searchCh` at or after `startOffset` which isn't escaped by `escapeCh`,
+// or std::string::npos if there is none within the first `len` characters of `str`.
+// Single pass, an escape character always consumes the character following it.
 size_t find_unescaped(
   char const *str,
+  size_t len,
   char searchCh,
   char escapeCh,
   size_t startOffset = 0
 );
 
+// Non-cryptographic 64-bit hash (MurmurHash64A), stable across platforms of the same endianness.
+uint64_t hash_bytes(std::string_view bytes, uint64_t seed = 0) noexcept;
+
+// 32 hex characters identifying `bytes` in a content-addressed store, `seed` stands for everything
+// else the stored data depends on (e.g. a version and options).
+std::string content_key(std::string_view bytes, uint64_t seed);
+
+// "<directory>/<first 2 characters of key>/<key><extension>", spreading the entries of a
+// content-addressed store over subdirectories.
+std::string sharded_entry_path(std::string const &directory, std::string const &key, char const *extension);
+
+// LEB128 varints, 7 bits per byte, for compact on-disk formats.
+void append_varint(std::string &out, uint64_t value);
+
+// Reads the varint at `pos`, advancing it. False (leaving `pos` as is) if it is cut off or overlong.
+bool read_varint(std::string_view bytes, size_t &pos, uint64_t &value) noexcept;
+
 std::fstream open_file(char const *path, int flags);
 std::vector<char> extract_bin_file_contents(char const *path);
 std::string extract_txt_file_contents(char const *path);
 
+// Replaces the contents of `path` such that readers only ever see the old or the new contents:
+// writes to a temporary file next to it (keeping the original's permissions) which is then renamed over it.
+void write_file_atomically(std::string const &path, std::string_view content);
+
+// Read-only view of a file's bytes. Memory-mapped where the platform and file allow it,
+// otherwise the file is read into memory with a single read. The bytes are NOT null-terminated
+// and are exactly what's on disk (CRLF line endings included, the lexer understands them).
+class MappedFile {
+  public:
+    explicit MappedFile(char const *path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+    MappedFile(MappedFile &&) noexcept;
+    MappedFile &operator=(MappedFile &&) noexcept;
+
+    char const *data() const noexcept;
+    size_t size() const noexcept;
+    std::string_view view() const noexcept;
+
+    // false if the read fallback was used
+    bool is_mapped() const noexcept;
+
+  private:
+    void release() noexcept;
+
+    char const *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_isMapped = false;
+    std::vector<char> m_readBuffer{};
+};
+
+// The entry of an on-disk store at `path`, std::nullopt if it is missing or unreadable (e.g. removed
+// by another process in the meantime).
+std::optional<MappedFile> read_entry(std::string const &path);
+
+// Writes the entry of an on-disk store at `path` atomically, creating its directory first.
+void write_entry(std::string const &path, std::string_view bytes);
+
 // Returns the size of a static C-style array at compile time.
 template <typename ElemTy, size_t Length>
 consteval size_t lengthof(ElemTy (&)[Length]) { return Length; }